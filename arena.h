@@ -0,0 +1,94 @@
+#pragma once
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <sys/mman.h>
+#include "common.h"
+
+// every buffer of an arena starts on a cache line, so aligned simd loads work on any of them
+static constexpr size_t ARENA_ALIGNMENT = 64;
+static constexpr size_t HUGE_PAGE_BYTES = 2u << 20;
+
+// one aligned block carved into the buffers of its owner. reset() only allocates when the
+// buffers outgrow the block, a smaller layout reuses it, and a move hands the block over
+class Arena {
+public:
+    Arena() {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    Arena(Arena&& other) noexcept {
+	swap(other);
+    }
+
+    Arena& operator=(Arena&& other) noexcept {
+	swap(other);
+	return *this;
+    }
+
+    ~Arena() {
+	release();
+    }
+
+    // blocks of a huge page or more are aligned to huge pages and advised to use them
+    bool huge_pages = true;
+    size_t capacity = 0;
+    // bytes handed out since the last reset()
+    size_t used = 0;
+    // blocks allocated so far, a reset() that fits does not count
+    size_t allocations = 0;
+
+    static size_t aligned(size_t bytes) {
+	return (bytes + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+    }
+
+    // forgets the buffers taken so far and makes room for bytes, sum them up with aligned().
+    // the first keep bytes stay as they are, the contents after them are undefined
+    void reset(size_t bytes, size_t keep = 0) {
+	assert(keep <= bytes);
+	used = 0;
+	if (bytes <= capacity) return;
+	size_t alignment = huge_pages && bytes >= HUGE_PAGE_BYTES ? HUGE_PAGE_BYTES : ARENA_ALIGNMENT;
+	size_t rounded = (bytes + alignment - 1) & ~(alignment - 1);
+	u8* block = (u8*)aligned_alloc(alignment, rounded);
+	assert(block && "arena: out of memory");
+	// transparent huge pages, a hint the kernel may ignore
+	if (alignment == HUGE_PAGE_BYTES) madvise(block, rounded, MADV_HUGEPAGE);
+	if (keep) memcpy(block, data, keep);
+	release();
+	data = block;
+	capacity = rounded;
+	allocations++;
+    }
+
+    // the next count elements of the block, uninitialized
+    template<typename T> T* take(size_t count) {
+	static_assert(std::is_trivially_copyable<T>::value && alignof(T) <= ARENA_ALIGNMENT, "arena buffers are plain data");
+	size_t bytes = aligned(sizeof(T) * count);
+	assert(used + bytes <= capacity && "arena: reset() for all buffers first");
+	T* buffer = (T*)(data + used);
+	used += bytes;
+	return buffer;
+    }
+
+    void release() {
+	free(data);
+	data = NULL;
+	capacity = 0;
+	used = 0;
+    }
+
+    void swap(Arena& other) noexcept {
+	std::swap(data, other.data);
+	std::swap(huge_pages, other.huge_pages);
+	std::swap(capacity, other.capacity);
+	std::swap(used, other.used);
+	std::swap(allocations, other.allocations);
+    }
+
+private:
+    u8* data = NULL;
+};
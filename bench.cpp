@@ -0,0 +1,301 @@
+#include "cell_automata.h"
+#include "recorder.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+// sweeps apply_rules() over types, engines, sizes, densities and thread counts and reports
+// cell updates per second, so regressions of the rules and engines show up in the numbers.
+// results go to stdout and optionally to a json and / or csv file
+
+struct Bench_Config {
+    Automata_Type type;
+    Engine engine;
+    size_t width;
+    size_t height;
+    double density;
+    size_t threads;
+};
+
+struct Bench_Result {
+    Bench_Config config;
+    std::string rule;
+    u64 generations = 0;
+    // over the samples, a sample runs about sample_seconds
+    double mean_seconds = 0.0;
+    double stddev_seconds = 0.0;
+    double cells_per_second = 0.0;
+    double ns_per_cell = 0.0;
+    // estimate of the state read and written by one generation
+    double bytes_per_generation = 0.0;
+    // cost of Recorder::record() after every generation with --record, not part of mean_seconds
+    double record_seconds = 0.0;
+    double record_bytes = 0.0;
+};
+
+static const char* engine_names[ENGINE_MAX] = {"reference", "bit", "hashlife"};
+
+struct Bench_Options {
+    std::vector<size_t> sizes = {64, 256, 1024, 4096, 16384};
+    std::vector<double> densities = {0.05, 0.25, 0.5};
+    std::vector<size_t> threads;
+    const char* life_rule = "B3/S23";
+    u64 one_dim_rule = 30;
+    // the memo of hashlife on a random soup grows with the area, big soups only measure the allocator
+    size_t hashlife_max_size = 1024;
+    // rows kept by the 1D automats, they stream so the ring never fills up
+    size_t one_dim_height = 256;
+    int samples = 5;
+    double sample_seconds = 0.05;
+    const char* json_path = NULL;
+    const char* csv_path = NULL;
+    bool record = false;
+};
+
+// cells that one generation updates, a 1D generation is a single row
+size_t cells_per_generation(const Cell_Automat<u8>& automat) {
+    return automat.type == ONE_DIM ? automat.width : automat.width * automat.height;
+}
+
+double bytes_per_generation(const Cell_Automat<u8>& automat) {
+    if (automat.uses_bits()) {
+	size_t tiles = automat.bits.tiles_x * automat.bits.tiles_y;
+	double active = tiles ? (double)automat.bits.tiles_computed / tiles : 1.0;
+	return automat.bits.buffer_bytes() * active;
+    }
+    if (automat.uses_elementary_bits()) return 2.0 * automat.elementary.words * sizeof(u64);
+    if (automat.uses_hashlife()) return 0.0;
+    // the row is copied into the grid, read with its neighbours and written back
+    if (automat.type == ONE_DIM) return 3.0 * automat.width;
+    return automat.grid.bytes() + automat.next_grid.bytes();
+}
+
+Bench_Result run(const Bench_Config& config, const Bench_Options& options, Thread_Pool& pool) {
+    Cell_Automat<u8> automat(config.type, config.width, config.height, 0, 1);
+    automat.set_engine(config.engine);
+    if (config.type == TWO_DIM) automat.set_ruleset(options.life_rule);
+    else {
+	automat.set_ruleset_dec(options.one_dim_rule);
+	automat.set_streaming(true);
+    }
+    pool.set_threads(config.threads);
+    automat.set_thread_pool(&pool);
+    // the same soup for every engine and thread count
+    automat.random_seed = 1;
+    automat.randomize_cells(config.density);
+
+    Bench_Result result;
+    result.config = config;
+    result.rule = config.type == TWO_DIM ? automat.life_rule.to_string() : std::to_string(automat.one_dim_rules);
+
+    // the first generation allocates and warms the caches
+    automat.apply_rules();
+    typedef std::chrono::steady_clock clock;
+    Recorder recorder;
+    if (options.record) recorder.record(automat);
+    std::vector<double> per_generation;
+    double bytes = 0.0;
+    double record_seconds = 0.0;
+    for (int s = 0; s < options.samples; ++s) {
+	u64 generations = 0;
+	clock::time_point start = clock::now();
+	double elapsed = 0.0;
+	double recording = 0.0;
+	while (elapsed - recording < options.sample_seconds || generations == 0) {
+	    automat.apply_rules();
+	    bytes += bytes_per_generation(automat);
+	    generations++;
+	    if (options.record) {
+		clock::time_point record_start = clock::now();
+		recorder.record(automat);
+		recording += std::chrono::duration<double>(clock::now() - record_start).count();
+	    }
+	    elapsed = std::chrono::duration<double>(clock::now() - start).count();
+	}
+	per_generation.push_back((elapsed - recording) / generations);
+	result.generations += generations;
+	record_seconds += recording;
+    }
+    if (options.record) {
+	result.record_seconds = record_seconds / result.generations;
+	// the first record() is a keyframe of the soup
+	result.record_bytes = (double)recorder.recorded_bytes / (result.generations + 1);
+    }
+
+    double sum = 0.0;
+    for (double seconds : per_generation) sum += seconds;
+    result.mean_seconds = sum / per_generation.size();
+    double squares = 0.0;
+    for (double seconds : per_generation) squares += (seconds - result.mean_seconds) * (seconds - result.mean_seconds);
+    result.stddev_seconds = per_generation.size() > 1 ? sqrt(squares / (per_generation.size() - 1)) : 0.0;
+    double cells = cells_per_generation(automat);
+    result.cells_per_second = cells / result.mean_seconds;
+    result.ns_per_cell = result.mean_seconds * 1e9 / cells;
+    result.bytes_per_generation = bytes / result.generations;
+    return result;
+}
+
+void print_result(const Bench_Result& r) {
+    printf("%-2s %-9s %-8s %6zux%-6zu d %.2f t %2zu: %10.4f ms/gen +- %5.1f%% %9.3f Gcells/s %8.3f ns/cell %8.2f GB/s\n",
+	   r.config.type == ONE_DIM ? "1d" : "2d", engine_names[r.config.engine], r.rule.c_str(),
+	   r.config.width, r.config.height, r.config.density, r.config.threads,
+	   r.mean_seconds * 1e3, r.stddev_seconds / r.mean_seconds * 100.0, r.cells_per_second / 1e9,
+	   r.ns_per_cell, r.bytes_per_generation / r.mean_seconds / 1e9);
+    if (r.record_seconds > 0.0) printf("   record: %10.4f ms/gen %10.1f KiB/gen\n", r.record_seconds * 1e3, r.record_bytes / 1024.0);
+    fflush(stdout);
+}
+
+bool write_csv(const std::vector<Bench_Result>& results, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) return false;
+    fprintf(file, "type,engine,rule,width,height,density,threads,generations,mean_seconds,stddev_seconds,cells_per_second,ns_per_cell,bytes_per_generation,record_seconds,record_bytes\n");
+    for (const Bench_Result& r : results) {
+	fprintf(file, "%s,%s,%s,%zu,%zu,%g,%zu,%llu,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g\n",
+		r.config.type == ONE_DIM ? "1d" : "2d", engine_names[r.config.engine], r.rule.c_str(),
+		r.config.width, r.config.height, r.config.density, r.config.threads, (unsigned long long)r.generations,
+		r.mean_seconds, r.stddev_seconds, r.cells_per_second, r.ns_per_cell, r.bytes_per_generation,
+		r.record_seconds, r.record_bytes);
+    }
+    fclose(file);
+    return true;
+}
+
+bool write_json(const std::vector<Bench_Result>& results, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) return false;
+    fprintf(file, "[\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+	const Bench_Result& r = results[i];
+	fprintf(file, "  {\"type\": \"%s\", \"engine\": \"%s\", \"rule\": \"%s\", \"width\": %zu, \"height\": %zu, "
+		"\"density\": %g, \"threads\": %zu, \"generations\": %llu, \"mean_seconds\": %.9g, \"stddev_seconds\": %.9g, "
+		"\"cells_per_second\": %.9g, \"ns_per_cell\": %.9g, \"bytes_per_generation\": %.9g, "
+		"\"record_seconds\": %.9g, \"record_bytes\": %.9g}%s\n",
+		r.config.type == ONE_DIM ? "1d" : "2d", engine_names[r.config.engine], r.rule.c_str(),
+		r.config.width, r.config.height, r.config.density, r.config.threads, (unsigned long long)r.generations,
+		r.mean_seconds, r.stddev_seconds, r.cells_per_second, r.ns_per_cell, r.bytes_per_generation,
+		r.record_seconds, r.record_bytes, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "]\n");
+    fclose(file);
+    return true;
+}
+
+void usage() {
+    fprintf(stderr,
+	"usage: cell_automata_bench [options]\n"
+	"  --sizes N,N,...       square 2d sizes and 1d widths (64,256,1024,4096,16384)\n"
+	"  --densities D,D,...   alive fraction of the soups (0.05,0.25,0.5)\n"
+	"  --threads N,N,...     (1 and all cores)\n"
+	"  --life-rule R         rule of the 2d automats (B3/S23)\n"
+	"  --one-dim-rule N      wolfram number of the 1d automats (30)\n"
+	"  --hashlife-max N      biggest hashlife soup (1024)\n"
+	"  --samples N           timed samples per configuration (5)\n"
+	"  --sample-seconds S    minimum length of a sample (0.05)\n"
+	"  --quick               sizes up to 1024, one density\n"
+	"  --record              also times recording every generation for replay\n"
+	"  --json PATH, --csv PATH\n");
+}
+
+template<typename V> bool parse_list(const char* s, std::vector<V>& out) {
+    out.clear();
+    while (*s) {
+	char* end = NULL;
+	double value = strtod(s, &end);
+	if (end == s || value <= 0.0) return false;
+	out.push_back((V)value);
+	s = *end == ',' ? end + 1 : end;
+	if (*end && *end != ',') return false;
+    }
+    return !out.empty();
+}
+
+bool parse_options(int argc, char** argv, Bench_Options& options) {
+    for (int i = 1; i < argc; ++i) {
+	const char* arg = argv[i];
+	if (!strcmp(arg, "--quick")) {
+	    options.sizes = {64, 256, 1024};
+	    options.densities = {0.25};
+	    continue;
+	}
+	if (!strcmp(arg, "--record")) {
+	    options.record = true;
+	    continue;
+	}
+	if (!strcmp(arg, "--help") || i + 1 >= argc) return false;
+	const char* value = argv[++i];
+	double number = atof(value);
+	if (!strcmp(arg, "--sizes")) {
+	    if (!parse_list(value, options.sizes)) return false;
+	}
+	else if (!strcmp(arg, "--densities")) {
+	    if (!parse_list(value, options.densities)) return false;
+	}
+	else if (!strcmp(arg, "--threads")) {
+	    if (!parse_list(value, options.threads)) return false;
+	}
+	else if (!strcmp(arg, "--life-rule")) options.life_rule = value;
+	else if (!strcmp(arg, "--one-dim-rule") && number >= 0 && number < 256) options.one_dim_rule = number;
+	else if (!strcmp(arg, "--hashlife-max")) options.hashlife_max_size = number;
+	else if (!strcmp(arg, "--samples") && number >= 1) options.samples = number;
+	else if (!strcmp(arg, "--sample-seconds") && number > 0) options.sample_seconds = number;
+	else if (!strcmp(arg, "--json")) options.json_path = value;
+	else if (!strcmp(arg, "--csv")) options.csv_path = value;
+	else return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Bench_Options options;
+    if (!parse_options(argc, argv, options)) {
+	usage();
+	return 1;
+    }
+    Life_Rule rule;
+    if (!rule.parse(options.life_rule)) {
+	fprintf(stderr, "invalid life rule %s\n", options.life_rule);
+	return 1;
+    }
+    if (options.threads.empty()) {
+	size_t cores = std::thread::hardware_concurrency();
+	options.threads.push_back(1);
+	if (cores > 1) options.threads.push_back(cores);
+    }
+
+    Thread_Pool pool(1);
+    std::vector<Bench_Result> results;
+    for (int type = ONE_DIM; type < AUTOMATA_TYPE_MAX; ++type) {
+	for (int engine = REFERENCE_ENGINE; engine < ENGINE_MAX; ++engine) {
+	    // hashlife is TWO_DIM only
+	    if (engine == HASHLIFE_ENGINE && type == ONE_DIM) continue;
+	    for (size_t size : options.sizes) {
+		if (engine == HASHLIFE_ENGINE && size > options.hashlife_max_size) continue;
+		for (double density : options.densities) {
+		    for (size_t threads : options.threads) {
+			// hashlife steps on the calling thread only
+			if (engine == HASHLIFE_ENGINE && threads != options.threads[0]) continue;
+			size_t height = type == ONE_DIM ? options.one_dim_height : size;
+			Bench_Config config = {(Automata_Type)type, (Engine)engine, size, height, density, threads};
+			results.push_back(run(config, options, pool));
+			print_result(results.back());
+		    }
+		}
+	    }
+	}
+    }
+
+    if (options.json_path && !write_json(results, options.json_path)) {
+	fprintf(stderr, "could not write %s\n", options.json_path);
+	return 1;
+    }
+    if (options.csv_path && !write_csv(results, options.csv_path)) {
+	fprintf(stderr, "could not write %s\n", options.csv_path);
+	return 1;
+    }
+    return 0;
+}
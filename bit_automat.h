@@ -0,0 +1,235 @@
+#pragma once
+#include <cstring>
+#include <cassert>
+#include <vector>
+#include "common.h"
+#include "grid.h"
+#include "life_kernels.h"
+#include "thread_pool.h"
+
+// a tile is TILE_WORDS words (256 cells) wide and TILE_ROWS rows high
+#define TILE_WORDS 4
+#define TILE_ROWS 32
+
+// life-like automat (conway's game of life by default) with 64 cells packed into every word.
+// the packed rows are a Padded_Grid, so the kernel never has to check the boundary
+class Bit_Automat {
+public:
+    Bit_Automat() {}
+
+    Bit_Automat(size_t width, size_t height) {
+	init(width, height);
+    }
+
+    size_t width = 0;
+    size_t height = 0;
+    // words per row without the halo
+    size_t words = 0;
+    Padded_Grid<u64> cells;
+    Padded_Grid<u64> next;
+    Life_Rule rule;
+    Boundary boundary = BOUNDARY_TORUS;
+    // instruction set of the row kernel, the scalar kernel is kept for validation
+    Simd_Level simd = best_simd_level();
+    Life_Row_Func life_row = life_row_func(simd, rule);
+
+    // only tiles that changed in the last generation, or border one that did, are recomputed.
+    // B0 rules change empty tiles, they always run dense
+    bool sparse = true;
+    size_t tiles_x = 0;
+    size_t tiles_y = 0;
+    // per tile flag, set if the tile changed in the last generation
+    std::vector<u8> tile_changed;
+    std::vector<u8> tile_changed_next;
+    // per tile number of generations the tile was recomputed in
+    std::vector<u32> tile_updates;
+    // tiles recomputed and skipped in the last generation
+    size_t tiles_computed = 0;
+    size_t tiles_skipped = 0;
+    // rows of tiles are split over the pool when set, not owned by the automat
+    Thread_Pool* pool = NULL;
+    // the rows when init() is not given an arena
+    Arena storage;
+
+    static size_t arena_bytes(size_t width, size_t height) {
+	return 2 * Padded_Grid<u64>::arena_bytes(WORDS_FOR(width), height);
+    }
+
+    // the rows come from arena, which has room for arena_bytes() more, or from storage
+    void init(size_t width, size_t height, Arena* arena = NULL) {
+	this->width = width;
+	this->height = height;
+	words = WORDS_FOR(width);
+	if (!arena) {
+	    storage.reset(arena_bytes(width, height));
+	    arena = &storage;
+	}
+	cells.init(words, height, 0, *arena);
+	next.init(words, height, 0, *arena);
+	tiles_x = (words + TILE_WORDS - 1) / TILE_WORDS;
+	tiles_y = (height + TILE_ROWS - 1) / TILE_ROWS;
+	tile_changed.assign(tiles_x * tiles_y, 1);
+	tile_changed_next.assign(tiles_x * tiles_y, 0);
+	tile_updates.assign(tiles_x * tiles_y, 0);
+	clear();
+    }
+
+    size_t buffer_bytes() const {
+	return cells.bytes() + next.bytes();
+    }
+
+    void set_simd_level(Simd_Level level) {
+	simd = level;
+	life_row = life_row_func(simd, rule);
+    }
+
+    void set_rule(const Life_Rule& new_rule) {
+	rule = new_rule;
+	life_row = life_row_func(simd, rule);
+	mark_all_changed();
+    }
+
+    bool get(size_t x, size_t y) const {
+	return BIT_AT(x % WORD_BITS, cells.row(y)[x / WORD_BITS]);
+    }
+
+    void set(size_t x, size_t y, bool alive) {
+	u64& word = cells.row(y)[x / WORD_BITS];
+	if (alive) BIT_SET(x % WORD_BITS, word);
+	else BIT_RESET(x % WORD_BITS, word);
+	tile_changed[INDEX(x / WORD_BITS / TILE_WORDS, y / TILE_ROWS, tiles_x)] = 1;
+    }
+
+    void clear() {
+	cells.fill(0);
+	mark_all_changed();
+    }
+
+    // after the cells were written from outside every tile has to be recomputed once
+    void mark_all_changed() {
+	for (u8& changed : tile_changed) changed = 1;
+    }
+
+    size_t population() const {
+	size_t count = 0;
+	for (size_t y = 0; y < height; ++y) {
+	    const u64* r = cells.row(y);
+	    for (size_t i = 0; i < words; ++i) {
+		count += __builtin_popcountll(r[i]);
+	    }
+	}
+	return count;
+    }
+
+    template<typename T> void pack(const T* src, T one) {
+	for (size_t y = 0; y < height; ++y) {
+	    u64* r = cells.row(y);
+	    for (size_t i = 0; i < words; ++i) {
+		u64 word = 0;
+		size_t x0 = i * WORD_BITS;
+		size_t bits = width - x0 < WORD_BITS ? width - x0 : WORD_BITS;
+		for (size_t b = 0; b < bits; ++b) {
+		    if (src[INDEX(x0 + b, y, width)] == one) BIT_SET(b, word);
+		}
+		r[i] = word;
+	    }
+	}
+	mark_all_changed();
+    }
+
+    template<typename T> void unpack(T* dst, T zero, T one) const {
+	for (size_t y = 0; y < height; ++y) unpack_span(dst, zero, one, y, 0, width);
+    }
+
+    // only the cells in the dirty spans, the rest of dst already holds them
+    template<typename T> void unpack(T* dst, T zero, T one, const Dirty_Rows& dirty) const {
+	for (size_t y = 0; y < height; ++y) {
+	    if (dirty.is_dirty(y)) unpack_span(dst, zero, one, y, dirty.begin[y], dirty.end[y]);
+	}
+    }
+
+    template<typename T> void unpack_span(T* dst, T zero, T one, size_t y, size_t x0, size_t x1) const {
+	const u64* r = cells.row(y);
+	for (size_t x = x0; x < x1; ++x) {
+	    dst[INDEX(x, y, width)] = BIT_AT(x % WORD_BITS, r[x / WORD_BITS]) ? one : zero;
+	}
+    }
+
+
+    // one generation of the life-like rule, the neighbours of 64 cells are counted at once
+    // with a tree of bitwise adders
+    void step() {
+	fill_bit_halo(cells, width, boundary);
+	std::atomic<size_t> computed = 0;
+	if (pool) {
+	    pool->parallel_for(tiles_y, [&](size_t begin, size_t end) { computed += step_tile_rows(begin, end); });
+	}
+	else {
+	    computed = step_tile_rows(0, tiles_y);
+	}
+	tiles_computed = computed;
+	tiles_skipped = tiles_x * tiles_y - tiles_computed;
+	tile_changed.swap(tile_changed_next);
+	cells.swap(next);
+    }
+
+    // steps the tile rows [begin, end), returns the number of tiles that were recomputed.
+    // tiles only write their own cells and flags, so bands of tile rows can run in parallel
+    size_t step_tile_rows(size_t begin, size_t end) {
+	size_t computed = 0;
+	bool skip_stable = sparse && !rule.births_from_nothing();
+	for (size_t ty = begin; ty < end; ++ty) {
+	    for (size_t tx = 0; tx < tiles_x; ++tx) {
+		size_t t = INDEX(tx, ty, tiles_x);
+		if (skip_stable && !neighbourhood_changed(tx, ty)) {
+		    // next still holds the previous generation, which equals this one for a tile
+		    // that did not change, so nothing has to be written
+		    tile_changed_next[t] = 0;
+		    continue;
+		}
+		tile_changed_next[t] = step_tile(tx, ty);
+		tile_updates[t]++;
+		computed++;
+	    }
+	}
+	return computed;
+    }
+
+    // true if the tile or one of the eight tiles around it changed.
+    // the tiles always wrap, which only recomputes a few edge tiles too many for the other boundaries
+    bool neighbourhood_changed(size_t tx, size_t ty) const {
+	for (size_t dy = 0; dy < 3; ++dy) {
+	    size_t y = (ty + tiles_y + dy - 1) % tiles_y;
+	    for (size_t dx = 0; dx < 3; ++dx) {
+		size_t x = (tx + tiles_x + dx - 1) % tiles_x;
+		if (tile_changed[INDEX(x, y, tiles_x)]) return true;
+	    }
+	}
+	return false;
+    }
+
+    // writes the next generation of one tile, returns true if any cell changed
+    bool step_tile(size_t tx, size_t ty) {
+	size_t tail = width % WORD_BITS;
+	u64 tail_mask = tail ? (u64(1) << tail) - 1 : ~u64(0);
+	size_t w0 = tx * TILE_WORDS;
+	size_t w1 = w0 + TILE_WORDS < words ? w0 + TILE_WORDS : words;
+	size_t y0 = ty * TILE_ROWS;
+	size_t y1 = y0 + TILE_ROWS < height ? y0 + TILE_ROWS : height;
+	u64 diff = 0;
+	for (size_t y = y0; y < y1; ++y) {
+	    const u64* above = cells.row((long)y - 1) + w0;
+	    const u64* center = cells.row(y) + w0;
+	    const u64* below = cells.row(y + 1) + w0;
+	    u64* out = next.row(y) + w0;
+	    life_row(above, center, below, out, w1 - w0, rule);
+	    if (w1 == words) out[w1 - w0 - 1] &= tail_mask;
+	    for (size_t i = 0; i + w0 < w1; ++i) {
+		// the halo bit after the last cell of the row is not part of the state
+		u64 mask = i + w0 == words - 1 ? tail_mask : ~u64(0);
+		diff |= (out[i] ^ center[i]) & mask;
+	    }
+	}
+	return diff != 0;
+    }
+};
@@ -1,93 +1,193 @@
 #pragma once
+#include <algorithm>
 #include <cstdint>
 #include <cstdlib>
 #include <ctime>
 #include <iostream>
 #include <cassert>
-
-typedef uint64_t u64;
+#include <cstring>
+#include <utility>
+#include "common.h"
+#include "arena.h"
+#include "bit_automat.h"
+#include "elementary_automat.h"
+#include "grid.h"
+#include "hashlife.h"
+#include "random.h"
+#include "row_log.h"
+#include "state_hash.h"
+#include "thread_pool.h"
 
 enum Automata_Type {
     ONE_DIM, TWO_DIM, AUTOMATA_TYPE_MAX
 };
 
-#define INDEX(x, y, width) (x) + ((y) * (width))
-#define BIT_AT(i, map) ((map) >> (i) & u64(1))
-#define BIT_SET(i, map) ((map) |= (u64(1) << (i)))
-#define BIT_RESET(i, map) ((map) &= ~(u64(1) << (i))) 
+enum Engine {
+    // per cell rule functions working on padded grids of T
+    REFERENCE_ENGINE,
+    // bit packed rows, 64 cells per word
+    BIT_ENGINE,
+    // memoized quadtree on an unbounded plane, TWO_DIM only.
+    // cells is a window on the center of the universe, there is no boundary
+    HASHLIFE_ENGINE,
+    ENGINE_MAX
+};
 
+// T is the type of a cell state, zero and one are the dead and alive states.
+// colors are up to the viewer, a u8 state keeps the reference grids at a byte per cell
 template<typename T> class Cell_Automat {
 public:
     Cell_Automat() {
-	std::cout << "CELL_AUTOMAT: empty automat created, initialize with init()\n";
-        init(AUTOMATA_TYPE_MAX, 0, 0, 0, T(), T());		
+	init(AUTOMATA_TYPE_MAX, 0, 0, T(), T());
     }
 
+    // copies bring their cells up to date first, so the source is not const
     Cell_Automat(Cell_Automat& automat) {
-        init(automat);		
+	init(automat);
+    }
+
+    Cell_Automat(Cell_Automat&& automat) {
+	*this = std::move(automat);
     }
 
     Cell_Automat(Automata_Type type, size_t width, size_t height, T zero_value, T one_value) {
 	init(type, width, height, zero_value, one_value);
     };
 
-    ~Cell_Automat() {
-	delete[] cells;
-	delete[] initial_cells;
-	delete[] empty;
-	delete[] neighbour_mask;
-	std::cout << "CELL_AUTOMAT: destructor called\n";
-    };
+    Cell_Automat& operator=(Cell_Automat& automat) {
+	init(automat);
+	return *this;
+    }
+
+    // takes the buffers and the engine state over without copying a cell,
+    // automat is left uninitialized with the old buffers of this one to reuse
+    Cell_Automat& operator=(Cell_Automat&& automat) noexcept {
+	if (this == &automat) return *this;
+	arena = std::move(automat.arena);
+	size = automat.size;
+	width = automat.width;
+	height = automat.height;
+	num_neighbors = automat.num_neighbors;
+	generation = automat.generation;
+	neighbour_mask = automat.neighbour_mask;
+	cells = automat.cells;
+	initial_cells = automat.initial_cells;
+	zero = automat.zero;
+	one = automat.one;
+	type = automat.type;
+	one_dim_rules = automat.one_dim_rules;
+	streaming = automat.streaming;
+	spill = automat.spill;
+	dirty = std::move(automat.dirty);
+	life_rule = std::move(automat.life_rule);
+	engine = automat.engine;
+	boundary = automat.boundary;
+	grid = std::move(automat.grid);
+	next_grid = std::move(automat.next_grid);
+	bits = std::move(automat.bits);
+	elementary = std::move(automat.elementary);
+	hashlife = std::move(automat.hashlife);
+	cells_stale = automat.cells_stale;
+	pool = automat.pool;
+	random_seed = automat.random_seed;
+	rules = automat.rules;
+	automat.rules = NULL;
+	automat.init(AUTOMATA_TYPE_MAX, 0, 0, zero, one);
+	return *this;
+    }
 
     static constexpr int neighbourhood_sizes[AUTOMATA_TYPE_MAX] = {3, 9};
-    size_t size;
-    size_t width;
-    size_t height;
-    size_t num_neighbors; 
+    size_t size = 0;
+    size_t width = 0;
+    size_t height = 0;
+    size_t num_neighbors = 0;
     size_t generation = 0;
+    // cells, initial_cells, neighbour_mask and the grids of the engine in one aligned block
+    // that only grows
+    Arena arena;
+    // offsets of the neighbourhood in grid, the cell itself included
     int* neighbour_mask = NULL;
-    T* empty;
-    T* cells;
+    T* cells = NULL;
     // state before the simulation started
-    T* initial_cells;
+    T* initial_cells = NULL;
     T zero;
     T one;
-    Automata_Type type;
+    Automata_Type type = AUTOMATA_TYPE_MAX;
     u64 one_dim_rules = 0;
+    // ONE_DIM keeps going after height generations, cells is then a ring of the last height
+    // rows and generation g lives in row g % height
+    bool streaming = false;
+    // rows that scroll out of the ring are appended here when set, not owned by the automat
+    Row_Log* spill = NULL;
+    // cells changed since the viewer took them, cleared by the viewer
+    Dirty_Rows dirty;
+    // life-like rule of TWO_DIM, conway's game of life unless set_ruleset() says otherwise
+    Life_Rule life_rule;
+    Engine engine = REFERENCE_ENGINE;
+    Boundary boundary = BOUNDARY_TORUS;
+    // state of the REFERENCE_ENGINE for TWO_DIM and the next generation.
+    // ONE_DIM copies the current row into grid, its height is 1
+    Padded_Grid<T> grid;
+    Padded_Grid<T> next_grid;
+    // packed state of the BIT_ENGINE, cells is only a view of it
+    Bit_Automat bits;
+    // packed spacetime diagram of the BIT_ENGINE for ONE_DIM
+    Elementary_Automat elementary;
+    // state of the HASHLIFE_ENGINE, every apply_rules() jumps 2^hashlife.step_log generations
+    Hash_Life hashlife;
+    // cells lags behind the engine state until sync_cells()
+    bool cells_stale = false;
+    // splits apply_rules() into bands when set, not owned by the automat
+    Thread_Pool* pool = NULL;
+    // seed of the next randomize_cells(), every fill moves it on, so a seed gives the same
+    // sequence of soups on every machine and for any number of threads
+    u64 random_seed = 0;
 
-    void init(const Cell_Automat& automat) {
+    // a deep copy of the cells, the restart state, the rules, the engine and the boundary.
+    // pool and spill are not owned and stay unset, hashlife only gets the window of cells
+    void init(Cell_Automat& automat) {
+	if (this == &automat) return;
+	engine = automat.engine;
+	rules = automat.rules;
+	life_rule = automat.life_rule;
 	init(automat.type, automat.width, automat.height, automat.zero, automat.one);
-	this.rules = automat.rules;
-	this->set_cells(automat.cells);
+	set_boundary(automat.boundary);
+	one_dim_rules = automat.one_dim_rules;
+	streaming = automat.streaming;
+	random_seed = automat.random_seed;
+	generation = automat.generation;
+	memcpy(cells, automat.sync_cells(), sizeof(T) * size);
+	memcpy(initial_cells, automat.initial_cells, sizeof(T) * size);
+	load_engine();
     }
     void init(Automata_Type type, size_t width, size_t height, T zero, T one) {
-	std::cout << "init: type = " << type << ", width = " << width << " height = " << height << ", one = " << one << " zero = " << zero << "\n";
 	size = width * height;
 	this->width = width;
 	this->height = height;
 	this->zero = zero;
 	this->one = one;
 	this->type = type;
+	generation = 0;
+	if (type != ONE_DIM) streaming = false;
+	// the log was written for the old width
+	spill = NULL;
 
-	if (cells) delete[] cells;
-	if (initial_cells) delete[] initial_cells;
-	if (empty) delete[] empty;
-	cells = new T[size];
-	initial_cells = new T[size];
-	empty = new T[size];
-
+	num_neighbors = type < AUTOMATA_TYPE_MAX ? neighbourhood_sizes[type] : 0;
+	init_grids(false);
 	set_buf(cells, size, zero);
 	set_buf(initial_cells, size, zero);
-	set_buf(empty, size, zero);
+	dirty.init(width, height);
 	setup_neighborhood();
-	srand(time(NULL));
+	if (uses_hashlife()) hashlife.clear();
+	cells_stale = false;
 	switch (type) {
 	    case ONE_DIM:
 		this->rules = one_dim_rules_func;
 	    break;
 	    case TWO_DIM:
 
-		if (rules) this->rules = rules;
+		// a 1D automat that is re-inited as 2D keeps no 1D rules
+		if (rules && rules != one_dim_rules_func) this->rules = rules;
 		else this->rules = gol_rules_func;
 	    break;
 	    case AUTOMATA_TYPE_MAX:
@@ -95,18 +195,142 @@ public:
 	    default:
 	    assert(0 && "unreachable");
 	}
-	std::cout << "init: finished initializing automat\n";
     }
 
-    void setup_neighborhood() {
-	assert(type >= 0 && type <= AUTOMATA_TYPE_MAX);
-	if (type == AUTOMATA_TYPE_MAX) num_neighbors = 0;
-	else num_neighbors = neighbourhood_sizes[type];
+    // the hashlife engine only exists for TWO_DIM, ONE_DIM stays on the reference rules with it
+    void set_engine(Engine new_engine) {
+	assert(new_engine < ENGINE_MAX);
+	sync_cells();
+	engine = new_engine;
+	init_grids();
+	load_engine();
+    }
 
-	if (neighbour_mask) {
-	    delete [] neighbour_mask;
+    // bytes of cells, initial_cells and neighbour_mask at the start of the arena
+    size_t cell_bytes() const {
+	return 2 * Arena::aligned(sizeof(T) * size) + Arena::aligned(sizeof(int) * num_neighbors);
+    }
+
+    // lays out the buffers of the engine in the arena after the cells, only the engine in use
+    // gets any. the cells keep their contents if keep_cells is set, the engine starts empty.
+    // there is no allocation unless the buffers are bigger than ever before
+    void init_grids(bool keep_cells = true) {
+	bool one_dim = type == ONE_DIM;
+	size_t bytes = cell_bytes();
+	if (uses_grid()) {
+	    bytes += Padded_Grid<T>::arena_bytes(width, one_dim ? 1 : height);
+	    bytes += Padded_Grid<T>::arena_bytes(one_dim ? 0 : width, one_dim ? 0 : height);
+	}
+	if (uses_bits()) bytes += Bit_Automat::arena_bytes(width, height);
+	if (uses_elementary_bits()) bytes += Elementary_Automat::arena_bytes(width, height);
+	arena.reset(bytes, keep_cells ? cell_bytes() : 0);
+	cells = arena.take<T>(size);
+	initial_cells = arena.take<T>(size);
+	neighbour_mask = arena.take<int>(num_neighbors);
+
+	grid = Padded_Grid<T>();
+	next_grid = Padded_Grid<T>();
+	bits.cells = Padded_Grid<u64>();
+	bits.next = Padded_Grid<u64>();
+	elementary.rows = Padded_Grid<u64>();
+	if (uses_grid()) {
+	    grid.init(width, one_dim ? 1 : height, zero, arena);
+	    next_grid.init(one_dim ? 0 : width, one_dim ? 0 : height, zero, arena);
 	}
-	neighbour_mask = new int[num_neighbors];
+	if (uses_bits()) bits.init(width, height, &arena);
+	if (uses_elementary_bits()) elementary.init(width, height, &arena);
+    }
+
+    // hashlife runs on an unbounded plane, the boundary only applies to the other engines.
+    // false if the engine ignores it, the boundary is kept for the next engine either way
+    bool set_boundary(Boundary new_boundary) {
+	assert(new_boundary < BOUNDARY_MAX);
+	boundary = new_boundary;
+	bits.boundary = new_boundary;
+	elementary.boundary = new_boundary;
+	// the sparse stepper would keep skipping edge tiles that only the old boundary kept stable
+	bits.mark_all_changed();
+	return !uses_hashlife();
+    }
+
+    void set_thread_pool(Thread_Pool* new_pool) {
+	pool = new_pool;
+	bits.pool = new_pool;
+	elementary.pool = new_pool;
+    }
+
+    // the reference rules of TWO_DIM keep their state in grid, ONE_DIM only copies a row into it
+    bool uses_grid() const {
+	return type != AUTOMATA_TYPE_MAX && !uses_bits() && !uses_elementary_bits() && !uses_hashlife();
+    }
+
+    bool uses_bits() const {
+	return engine == BIT_ENGINE && type == TWO_DIM;
+    }
+
+    bool uses_elementary_bits() const {
+	return engine == BIT_ENGINE && type == ONE_DIM;
+    }
+
+    // B0 rules fall back to the reference rules, the unbounded plane would fill up
+    bool uses_hashlife() const {
+	return engine == HASHLIFE_ENGINE && type == TWO_DIM && !life_rule.births_from_nothing();
+    }
+
+    // true if hashlife was asked for and the rule keeps it on the reference rules
+    bool hashlife_fallback() const {
+	return engine == HASHLIFE_ENGINE && type == TWO_DIM && life_rule.births_from_nothing();
+    }
+
+    // copies cells into the state of the engine after they were changed from outside
+    void load_engine() {
+	cells_stale = false;
+	dirty.mark_all();
+	if (uses_bits()) {
+	    bits.set_rule(life_rule);
+	    bits.pack(cells, one);
+	}
+	else if (uses_elementary_bits()) {
+	    elementary.pack(cells, one);
+	}
+	else if (uses_hashlife()) {
+	    hashlife.set_rule(life_rule);
+	    hashlife.load(cells, width, height, one);
+	    // the universe goes on from the generation of the automat, whatever engine got it there
+	    hashlife.generation = generation;
+	}
+	else if (uses_grid() && type == TWO_DIM) {
+	    grid.load(cells);
+	}
+    }
+
+    // brings the T buffer up to date after the engine stepped
+    T* sync_cells() {
+	if (cells_stale) {
+	    // everything that changed since the last sync is still marked dirty
+	    if (uses_bits()) bits.unpack(cells, zero, one, dirty);
+	    else if (uses_elementary_bits()) elementary.unpack(cells, zero, one);
+	    else if (uses_hashlife()) hashlife.store(cells, width, height, zero, one);
+	    else if (uses_grid() && type == TWO_DIM) grid.store(cells, dirty);
+	    cells_stale = false;
+	}
+	return cells;
+    }
+
+    void set_cell(size_t x, size_t y, T value) {
+	assert(x < width && y < height);
+	sync_cells();
+	dirty.mark(y, x, x + 1);
+	cells[INDEX(x, y, width)] = value;
+	if (uses_bits()) bits.set(x, y, value == one);
+	else if (uses_elementary_bits()) elementary.set(x, y, value == one);
+	else if (uses_hashlife()) hashlife.set_cell((long)x - (long)width / 2, (long)y - (long)height / 2, value == one);
+	else if (uses_grid() && type == TWO_DIM) grid.row(y)[x] = value;
+    }
+
+    void setup_neighborhood() {
+	assert(type >= 0 && type <= AUTOMATA_TYPE_MAX);
+	// init() took num_neighbors ints for the mask from the arena
 
 	int index = 0;
 	switch(type) {
@@ -120,13 +344,12 @@ public:
 		for (int y = -1; y <= 1; ++y) {
 		    for (int x = -1; x <= 1; ++x) {
 			assert(index < num_neighbors);
-			int neighbor = INDEX(x, y, width);
+			int neighbor = INDEX(x, y, (int)Padded_Grid<T>::stride_for(width));
 			neighbour_mask[index++] = neighbor;
 		    }
 		}
 	    break;
 	    case AUTOMATA_TYPE_MAX:
-		std::cout << "empty automat, no neighbours :(\n";
 	    break;
 	    default:
 		assert(0 && "unreachable");
@@ -134,8 +357,25 @@ public:
     }
     void set_ruleset_dec(u64 dec) {
 	one_dim_rules = dec;
-	std::cout << "new decimal ruleset = " << one_dim_rules << "\n";
     }
+    // life-like rule of TWO_DIM from a rulestring like "B36/S23", false if it does not parse.
+    // a B0 rule moves hashlife to the reference rules, see hashlife_fallback()
+    bool set_ruleset(const char* rulestring) {
+	Life_Rule rule;
+	if (!rule.parse(rulestring)) return false;
+	if (uses_hashlife() && !rule.births_from_nothing()) {
+	    // the universe goes on under the new rule, only the memo is dropped
+	    life_rule = rule;
+	    hashlife.set_rule(life_rule);
+	    return true;
+	}
+	sync_cells();
+	life_rule = rule;
+	init_grids();
+	load_engine();
+	return true;
+    }
+
     void set_ruleset_bin(const char* rules_string) {
 	assert(type == ONE_DIM && "wrong type");
 	int i = 0;
@@ -143,7 +383,6 @@ public:
 	while(rules_string[i++] != '\0') {
 	    size++; 
 	}
-	std::cout << "size of ruleset = " << size << "\n";
 	i = 0;
 	while(size > 0) {
 	    size--;
@@ -152,31 +391,98 @@ public:
 	    }
 	    i++;
 	}
-	std::cout << "new string ruleset = " << one_dim_rules << "\n";
     }
 
     void print() {
 	std::cout << "\n----Automat info--------\n";
 	std::cout << "type: " << (type == ONE_DIM ? "1D elementary" : "2D") << "\n";
+	if (type == TWO_DIM) std::cout << "rule: " << life_rule.to_string() << "\n";
+	if (uses_bits()) {
+	    std::cout << "engine: bit packed, " << simd_level_names[bits.simd] << (bits.sparse ? ", sparse" : "") << "\n";
+	    std::cout << "tiles computed = " << bits.tiles_computed << ", skipped = " << bits.tiles_skipped << " in the last generation\n";
+	}
+	else if (uses_elementary_bits()) std::cout << "engine: bit packed, " << simd_level_names[elementary.simd] << "\n";
+	else if (uses_hashlife()) std::cout << "engine: hashlife, step = 2^" << hashlife.step_log << ", nodes = " << hashlife.node_count << "\n";
+	else std::cout << "engine: reference\n";
+	if (!uses_hashlife()) std::cout << "boundary: " << boundary_names[boundary] << "\n";
 	std::cout << "width = "  << width << ", height = " << height << "\n";
-	std::cout << "empty/dead value = "  << zero << ", alive/one value = " << one << "\n";
-	std::cout << "cells pointer = "  << cells << ", empty/next frame pointer = " << empty << "\n";
+	std::cout << "empty/dead value = "  << +zero << ", alive/one value = " << +one << "\n";
+	std::cout << "cells pointer = "  << (void*)cells << ", arena bytes = " << arena.capacity << ", grid bytes = " << grid.bytes() + next_grid.bytes() << "\n";
 	std::cout << "number of neighbours of any cell = "  << num_neighbors << ", neighbourhood mask pointer = " << neighbour_mask << "\n";
 	std::cout << "----Automat info end----\n";
     }
 
+    // hash of the states, the same for every engine, see State_Hash
+    u64 hash_cells() {
+	return State_Hash<T>::hash(sync_cells(), width, height);
+    }
+
+    size_t population() {
+	const T* c = sync_cells();
+	size_t count = 0;
+	for (size_t i = 0; i < size; ++i) count += c[i] != zero;
+	return count;
+    }
+
     void clear_cells() {
 	set_buf(cells, size, zero);
+	load_engine();
+    }
+
+    // every cell alive with the density, 1D automats only get a random first row and start over
+    void randomize_cells(double density = 0.5) {
+	if (type == ONE_DIM) {
+	    set_buf(cells, size, zero);
+	    load_engine();
+	    // the first row is the new start of the spacetime diagram
+	    generation = 0;
+	}
+	randomize_rect(0, 0, width, type == ONE_DIM ? 1 : height, density);
     }
 
-    void randomize_cells() {
-	int limit = size;
-	if (type == ONE_DIM) limit = width;
-	for (int i = 0; i < size; ++i) {
-	    if (i < limit && rand() / (RAND_MAX / 2)) {
-		cells[i] = one;
+    // fills [x0, x1) x [y0, y1) and keeps the other cells, the fill becomes the state restart()
+    // returns to. cells are drawn 64 at a time from random_cells() with a counter per word of
+    // the grid, so a cell gets the same value for a seed whatever the rectangle and the bands.
+    // the bit engines get the words as they are and unpack only the rectangle
+    void randomize_rect(size_t x0, size_t y0, size_t x1, size_t y1, double density = 0.5) {
+	assert(x0 <= x1 && x1 <= width && y0 <= y1 && y1 <= height);
+	if (x0 == x1 || y0 == y1) return;
+	sync_cells();
+	u64 seed = random_seed;
+	random_seed = next_seed(random_seed);
+	u64 fixed = random_density(density);
+	size_t words = WORDS_FOR(width);
+	bool packed = uses_bits() || uses_elementary_bits();
+	auto fill = [&](size_t begin, size_t end) {
+	    for (size_t y = y0 + begin; y < y0 + end; ++y) {
+		u64* row = uses_bits() ? bits.cells.row(y) : uses_elementary_bits() ? elementary.row(y) : NULL;
+		T* out = cells + y * width;
+		for (size_t i = x0 / WORD_BITS; i <= (x1 - 1) / WORD_BITS; ++i) {
+		    u64 word = random_cells(seed, y * words + i, fixed);
+		    size_t begin_x = std::max(i * WORD_BITS, x0);
+		    size_t end_x = std::min((i + 1) * WORD_BITS, x1);
+		    if (packed) {
+			// the cells of the word inside the rectangle
+			u64 mask = (end_x - begin_x == WORD_BITS ? ~u64(0) : (u64(1) << (end_x - begin_x)) - 1) << (begin_x % WORD_BITS);
+			row[i] = (row[i] & ~mask) | (word & mask);
+			continue;
+		    }
+		    for (size_t x = begin_x; x < end_x; ++x) out[x] = BIT_AT(x % WORD_BITS, word) ? one : zero;
+		}
 	    }
-	    else cells[i] = zero;
+	};
+	if (pool) pool->parallel_for(y1 - y0, fill);
+	else fill(0, y1 - y0);
+
+	if (packed) {
+	    if (uses_bits()) bits.mark_all_changed();
+	    else for (size_t y = y0; y < y1; ++y) elementary.row_dirty[y] = 1;
+	    dirty.mark_rows(y0, y1, x0, x1);
+	    cells_stale = true;
+	    sync_cells();
+	}
+	else {
+	    load_engine();
 	}
 	memcpy(initial_cells, cells, sizeof(T) * size);
     }
@@ -184,16 +490,95 @@ public:
     void set_cells(T* new_input) {
 	memcpy(cells, new_input, sizeof(T) * size);
 	memcpy(initial_cells, new_input, sizeof(T) * size);
+	load_engine();
+    }
+
+    // back to the state before the simulation started
+    void restart() {
+	generation = 0;
+	memcpy(cells, initial_cells, sizeof(T) * size);
+	load_engine();
+    }
+
+    // row of the oldest generation in cells, rows after it follow in order and wrap around
+    size_t first_row() const {
+	if (type != ONE_DIM) return 0;
+	return generation >= height ? (generation + 1) % height : 0;
+    }
+
+    void set_streaming(bool on) {
+	assert((!on || type == ONE_DIM) && "only ONE_DIM automats stream");
+	streaming = on;
     }
 
     void apply_rules() {
-	rules(*this);
-	if (type != ONE_DIM) {
-	    switch_buffers();
+	if (type == ONE_DIM) {
+	    // bounded automats stop once the last row is written
+	    if (!streaming && generation >= height - 1) return;
+	    if (spill && generation + 1 >= height) spill_row(generation + 1 - height);
+	}
+	if (type == ONE_DIM) dirty.mark((generation + 1) % height, 0, width);
+	if (uses_bits()) {
+	    bits.step();
+	    mark_changed_tiles();
+	    cells_stale = true;
+	    generation++;
+	    return;
+	}
+	if (uses_elementary_bits()) {
+	    elementary.step(generation % height, one_dim_rules);
+	    cells_stale = true;
+	    generation++;
+	    return;
+	}
+	if (uses_hashlife()) {
+	    hashlife.advance();
+	    dirty.mark_all();
+	    cells_stale = true;
+	    generation = hashlife.generation;
+	    return;
+	}
+	// rules are called on bands of rows, or of columns for the single row of ONE_DIM.
+	// every band only writes its own part of the next generation, so bands can run in parallel
+	if (type == ONE_DIM) memcpy(grid.row(0), cells + INDEX(0, generation % height, width), sizeof(T) * width);
+	grid.fill_halo(boundary, zero);
+	size_t extent = type == ONE_DIM ? width : height;
+	if (pool) {
+	    pool->parallel_for(extent, [this](size_t begin, size_t end) { rules(*this, begin, end); });
 	}
 	else {
-	    if (generation < height - 1) generation++;
+	    rules(*this, 0, extent);
+	}
+	if (type != ONE_DIM) {
+	    grid.swap(next_grid);
+	    cells_stale = true;
+	}
+	generation++;
+    }
+
+    void mark_changed_tiles() {
+	for (size_t ty = 0; ty < bits.tiles_y; ++ty) {
+	    for (size_t tx = 0; tx < bits.tiles_x; ++tx) {
+		if (!bits.tile_changed[INDEX(tx, ty, bits.tiles_x)]) continue;
+		size_t x0 = tx * TILE_WORDS * WORD_BITS;
+		size_t y0 = ty * TILE_ROWS;
+		dirty.mark_rows(y0, std::min(y0 + TILE_ROWS, height), x0, std::min(x0 + TILE_WORDS * WORD_BITS, width));
+	    }
+	}
+    }
+
+    // appends the row of a generation that is about to be overwritten to the spill log
+    void spill_row(size_t old_generation) {
+	size_t y = old_generation % height;
+	if (uses_elementary_bits()) {
+	    spill->append(old_generation, elementary.row(y));
+	    return;
+	}
+	std::vector<u64> bits(WORDS_FOR(width), 0);
+	for (size_t x = 0; x < width; ++x) {
+	    if (cells[INDEX(x, y, width)] == one) BIT_SET(x % WORD_BITS, bits[x / WORD_BITS]);
 	}
+	spill->append(old_generation, bits.data());
     }
     static void set_buf(T* buf, size_t size, T val) {
 	for(int i = 0; i < size; ++i) {
@@ -203,73 +588,54 @@ public:
 
     void set_rules_gol() {
 	rules = gol_rules_func;
+	set_ruleset("B3/S23");
     }
 
     bool is_initialized() {
 	return type != AUTOMATA_TYPE_MAX;
     }
 
-    void (*rules) (Cell_Automat& automat);
+    void (*rules) (Cell_Automat& automat, size_t begin, size_t end) = NULL;
 
-    // rules of conway's game of life
-    static void gol_rules_func(Cell_Automat& automat) {
-	for (int y = 0; y < automat.height; ++y) {
-	    for (int x = 0; x < automat.width; ++x) {
-		int index = x + y * automat.width;
-		T input_val = automat.cells[index];
-		if (input_val != automat.one && input_val != automat.zero) {
-		    std::cout << "wrong colors! input_val = " << input_val << "\n";
-		    std::cout << "alive color = " << automat.one << "\ndead color = " << automat.zero << "\n";
-		}
-
-		int neighbours = 0; 
-		for (int i = 0; i < automat.num_neighbors; ++i) {
-		    int new_index = index + automat.neighbour_mask[i];
-		    if(new_index < 0) new_index += automat.width;
-		    else if(new_index >= automat.size) new_index -= automat.width;
-		    if (new_index != index && automat.cells[new_index] != automat.zero) {
-			neighbours++;
-		    }
-		}
-
-		bool alive = (input_val == automat.one);
-		if(alive && neighbours == 3) automat.empty[index] = automat.one;
-		else if(alive && neighbours == 2) automat.empty[index] = automat.one;
-		else if(alive && neighbours < 2) automat.empty[index] = automat.zero;
-		else if(alive && neighbours > 3) automat.empty[index] = automat.zero;
-		else if(!alive && neighbours == 3) automat.empty[index] = automat.one;
-		else if(!alive && neighbours != 3) automat.empty[index] = automat.zero;
-		else {
-		    assert(0 && "unreachable");
+    // life-like rules (conway's game of life by default) for the rows [begin, end).
+    // the halo of grid is filled, so no neighbour is out of bounds
+    static void gol_rules_func(Cell_Automat& automat, size_t begin, size_t end) {
+	const int* mask = automat.neighbour_mask;
+	size_t num_neighbors = automat.num_neighbors;
+	for (size_t y = begin; y < end; ++y) {
+	    const T* in = automat.grid.row(y);
+	    T* out = automat.next_grid.row(y);
+	    for (size_t x = 0; x < automat.width; ++x) {
+		const T* cell = in + x;
+		int neighbours = 0;
+		for (size_t i = 0; i < num_neighbors; ++i) {
+		    neighbours += cell[mask[i]] != automat.zero;
 		}
+		// the mask includes the cell itself
+		neighbours -= *cell != automat.zero;
+		bool alive = *cell == automat.one;
+		// the birth / survive masks are the lookup table of the rule
+		out[x] = automat.life_rule.next_state(alive, neighbours) ? automat.one : automat.zero;
 	    }
+	    size_t first = 0;
+	    size_t last = automat.width;
+	    while (first < last && out[first] == in[first]) first++;
+	    while (last > first && out[last - 1] == in[last - 1]) last--;
+	    automat.dirty.mark(y, first, last);
 	}
     }
-    void switch_buffers() {
-	T* h = cells;
-	cells = empty;
-	empty = h;
-    }
-
-    static void one_dim_rules_func(Cell_Automat& automat) {
-	if (automat.generation < automat.height - 1) {
-	    int y = automat.generation;
-	    for (int x = 0; x < automat.width; ++x) {
-		T rule_index = 0;
-		T index = INDEX(x, y, automat.width);
-		for (int n_i = 0; n_i < 3; ++n_i) {
-		    int new_index = INDEX(x, y, automat.width) + automat.neighbour_mask[n_i];
-		    if (new_index < 0) new_index += automat.width;
-		    else if (new_index >= automat.size) new_index -= automat.width;
-		    if (automat.cells[new_index] == automat.one) {
-			rule_index |= (T)(1) << (2 - n_i);
-		    }
-		}
-		T new_value = BIT_AT(rule_index, automat.one_dim_rules) ? automat.one : automat.zero;
-		assert(rule_index < 8);
-		assert(rule_index >= 0);
-		automat.cells[INDEX(x, y + 1, automat.width)] = new_value;
+
+    // next row of the elementary automat for the columns [begin, end), grid holds the current
+    // row with its halo
+    static void one_dim_rules_func(Cell_Automat& automat, size_t begin, size_t end) {
+	const T* in = automat.grid.row(0);
+	T* out = automat.cells + INDEX(0, (automat.generation + 1) % automat.height, automat.width);
+	for (size_t x = begin; x < end; ++x) {
+	    T rule_index = 0;
+	    for (int n_i = 0; n_i < 3; ++n_i) {
+		rule_index |= (T)(in[x + automat.neighbour_mask[n_i]] == automat.one) << (2 - n_i);
 	    }
+	    out[x] = BIT_AT(rule_index, automat.one_dim_rules) ? automat.one : automat.zero;
 	}
     }
 };
@@ -0,0 +1,12 @@
+#pragma once
+#include <cstdint>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define INDEX(x, y, width) (x) + ((y) * (width))
+#define BIT_AT(i, map) ((map) >> (i) & u64(1))
+#define BIT_SET(i, map) ((map) |= (u64(1) << (i)))
+#define BIT_RESET(i, map) ((map) &= ~(u64(1) << (i))) 
@@ -0,0 +1,133 @@
+#pragma once
+#include <cstring>
+#include <cassert>
+#include <vector>
+#include "common.h"
+#include "grid.h"
+#include "life_kernels.h"
+#include "thread_pool.h"
+
+// elementary (1D) automat with 64 cells packed into every word.
+// the rows of the spacetime diagram are a ring of the last height generations.
+// the packed rows are a Padded_Grid, so the kernel never has to check the boundary of a row
+class Elementary_Automat {
+public:
+    Elementary_Automat() {}
+
+    Elementary_Automat(size_t width, size_t height) {
+	init(width, height);
+    }
+
+    size_t width = 0;
+    size_t height = 0;
+    // words per row without the halo
+    size_t words = 0;
+    Padded_Grid<u64> rows;
+    Boundary boundary = BOUNDARY_TORUS;
+    // per row flag, set if the row changed since the last unpack()
+    std::vector<u8> row_dirty;
+    Simd_Level simd = best_simd_level();
+    Elementary_Row_Func elementary_row = elementary_row_func(simd);
+    // rows are split over the pool when set and wide enough, not owned by the automat
+    Thread_Pool* pool = NULL;
+    // narrower rows are not worth waking the workers for
+    static constexpr size_t min_parallel_words = 4096;
+    // the rows when init() is not given an arena
+    Arena storage;
+
+    static size_t arena_bytes(size_t width, size_t height) {
+	return Padded_Grid<u64>::arena_bytes(WORDS_FOR(width), height);
+    }
+
+    // the rows come from arena, which has room for arena_bytes() more, or from storage
+    void init(size_t width, size_t height, Arena* arena = NULL) {
+	this->width = width;
+	this->height = height;
+	words = WORDS_FOR(width);
+	if (!arena) {
+	    storage.reset(arena_bytes(width, height));
+	    arena = &storage;
+	}
+	rows.init(words, height, 0, *arena);
+	row_dirty.assign(height, 0);
+	clear();
+    }
+
+    void set_simd_level(Simd_Level level) {
+	simd = level;
+	elementary_row = elementary_row_func(simd);
+    }
+
+    u64* row(size_t y) {
+	return rows.row(y);
+    }
+
+    const u64* row(size_t y) const {
+	return rows.row(y);
+    }
+
+    bool get(size_t x, size_t y) const {
+	return BIT_AT(x % WORD_BITS, row(y)[x / WORD_BITS]);
+    }
+
+    void set(size_t x, size_t y, bool alive) {
+	u64& word = row(y)[x / WORD_BITS];
+	if (alive) BIT_SET(x % WORD_BITS, word);
+	else BIT_RESET(x % WORD_BITS, word);
+    }
+
+    void clear() {
+	rows.fill(0);
+	for (u8& dirty : row_dirty) dirty = 1;
+    }
+
+    template<typename T> void pack(const T* src, T one) {
+	for (size_t y = 0; y < height; ++y) {
+	    u64* r = row(y);
+	    for (size_t i = 0; i < words; ++i) {
+		u64 word = 0;
+		size_t x0 = i * WORD_BITS;
+		size_t bits = width - x0 < WORD_BITS ? width - x0 : WORD_BITS;
+		for (size_t b = 0; b < bits; ++b) {
+		    if (src[INDEX(x0 + b, y, width)] == one) BIT_SET(b, word);
+		}
+		r[i] = word;
+	    }
+	    row_dirty[y] = 0;
+	}
+    }
+
+    // only unpacks the rows written since the last call
+    template<typename T> void unpack(T* dst, T zero, T one) {
+	for (size_t y = 0; y < height; ++y) {
+	    if (!row_dirty[y]) continue;
+	    const u64* r = row(y);
+	    for (size_t x = 0; x < width; ++x) {
+		dst[INDEX(x, y, width)] = BIT_AT(x % WORD_BITS, r[x / WORD_BITS]) ? one : zero;
+	    }
+	    row_dirty[y] = 0;
+	}
+    }
+
+    // writes the row after y (the first one after the last) from row y with the wolfram rule,
+    // 64 cells at once
+    void step(size_t y, u8 rule) {
+	assert(y < height);
+	size_t y_next = (y + 1) % height;
+	u64* in = row(y);
+	u64* out = row(y_next);
+	fill_bit_row_halo(in, width, boundary);
+	u8 anf = elementary_anf(rule);
+	if (pool && words >= min_parallel_words) {
+	    pool->parallel_for(words, [&](size_t begin, size_t end) {
+		elementary_row(in + begin, out + begin, end - begin, anf);
+	    });
+	}
+	else {
+	    elementary_row(in, out, words, anf);
+	}
+	size_t tail = width % WORD_BITS;
+	if (tail) out[words - 1] &= (u64(1) << tail) - 1;
+	row_dirty[y_next] = 1;
+    }
+};
@@ -0,0 +1,242 @@
+#pragma once
+#include <cstring>
+#include <cassert>
+#include <utility>
+#include <vector>
+#include "common.h"
+#include "arena.h"
+
+// what the cells outside of the grid look like
+enum Boundary {
+    // the grid wraps around, left touches right and top touches bottom
+    BOUNDARY_TORUS,
+    // everything outside is dead
+    BOUNDARY_DEAD,
+    // the cells outside copy the cells on the edge, as if the grid was reflected there
+    BOUNDARY_MIRROR,
+    BOUNDARY_MAX
+};
+
+static const char* boundary_names[BOUNDARY_MAX] = {"torus", "dead", "mirror"};
+
+// halo of a row of width cells, r[-1] and r[width] are the halo cells
+template<typename T> static void fill_cell_row_halo(T* r, size_t width, Boundary boundary, T dead) {
+    switch (boundary) {
+	case BOUNDARY_TORUS:
+	    r[-1] = r[width - 1];
+	    r[width] = r[0];
+	break;
+	case BOUNDARY_MIRROR:
+	    r[-1] = r[0];
+	    r[width] = r[width - 1];
+	break;
+	default:
+	    r[-1] = r[width] = dead;
+    }
+}
+
+// cells that changed since the viewer last looked, as one column span per row.
+// rows are only written by whoever steps them, so bands of rows can mark in parallel
+struct Dirty_Rows {
+    size_t width = 0;
+    // span [begin, end) of row y, empty if begin >= end
+    std::vector<u32> begin;
+    std::vector<u32> end;
+
+    void init(size_t width, size_t height) {
+	this->width = width;
+	begin.assign(height, 0);
+	end.assign(height, width);
+    }
+
+    size_t height() const {
+	return begin.size();
+    }
+
+    bool is_dirty(size_t y) const {
+	return begin[y] < end[y];
+    }
+
+    bool any() const {
+	for (size_t y = 0; y < height(); ++y) if (is_dirty(y)) return true;
+	return false;
+    }
+
+    void mark(size_t y, size_t x0, size_t x1) {
+	if (x0 >= x1) return;
+	if (!is_dirty(y)) {
+	    begin[y] = x0;
+	    end[y] = x1;
+	    return;
+	}
+	if (x0 < begin[y]) begin[y] = x0;
+	if (x1 > end[y]) end[y] = x1;
+    }
+
+    void mark_rows(size_t y0, size_t y1, size_t x0, size_t x1) {
+	for (size_t y = y0; y < y1; ++y) mark(y, x0, x1);
+    }
+
+    void mark_all() {
+	mark_rows(0, height(), 0, width);
+    }
+
+    void clear() {
+	for (size_t y = 0; y < height(); ++y) begin[y] = end[y] = 0;
+    }
+};
+
+// width x height elements with a halo of one element around them.
+// the halo is filled once per generation from the boundary mode, so the kernels read the
+// neighbours of every cell without checking for the edge.
+// the engines store cells of T directly, or 64 cells packed into an u64 with width in words.
+// the elements live in an arena owned by the engine. every row starts on a cache line:
+// it is padded with a cache line in front, the halo element is the last one of it, and
+// the stride is rounded up to whole cache lines
+template<typename T> class Padded_Grid {
+public:
+    Padded_Grid() {}
+
+    Padded_Grid(const Padded_Grid&) = delete;
+    Padded_Grid& operator=(const Padded_Grid&) = delete;
+
+    // the elements stay in the arena, so a move only hands the pointer over
+    Padded_Grid(Padded_Grid&& other) noexcept {
+	swap(other);
+    }
+
+    Padded_Grid& operator=(Padded_Grid&& other) noexcept {
+	swap(other);
+	return *this;
+    }
+
+    static_assert(ARENA_ALIGNMENT % sizeof(T) == 0, "rows are aligned in whole elements");
+    // elements in front of the first element of a row
+    static constexpr size_t pad = ARENA_ALIGNMENT / sizeof(T);
+
+    size_t width = 0;
+    size_t height = 0;
+    // elements per row with the padding and the halo
+    size_t stride = 0;
+    // stride * (height + 2) elements, not owned
+    T* data = NULL;
+    size_t elements = 0;
+
+    static size_t stride_for(size_t width) {
+	return (pad + width + 1 + pad - 1) / pad * pad;
+    }
+
+    // what init() takes from the arena
+    static size_t arena_bytes(size_t width, size_t height) {
+	return Arena::aligned(sizeof(T) * stride_for(width) * (height + 2));
+    }
+
+    void init(size_t width, size_t height, T value, Arena& arena) {
+	this->width = width;
+	this->height = height;
+	stride = stride_for(width);
+	elements = stride * (height + 2);
+	data = arena.take<T>(elements);
+	fill(value);
+    }
+
+    size_t bytes() const {
+	return sizeof(T) * elements;
+    }
+
+    // first element of row y, -1 and height are the halo rows
+    T* row(long y) {
+	return data + (y + 1) * stride + pad;
+    }
+
+    const T* row(long y) const {
+	return data + (y + 1) * stride + pad;
+    }
+
+    void fill(T value) {
+	for (size_t i = 0; i < elements; ++i) data[i] = value;
+    }
+
+    void swap(Padded_Grid& other) noexcept {
+	std::swap(width, other.width);
+	std::swap(height, other.height);
+	std::swap(stride, other.stride);
+	std::swap(data, other.data);
+	std::swap(elements, other.elements);
+    }
+
+    // copies the interior from / to a dense buffer of width x height
+    void load(const T* src) {
+	for (size_t y = 0; y < height; ++y) memcpy(row(y), src + y * width, sizeof(T) * width);
+    }
+
+    void store(T* dst) const {
+	for (size_t y = 0; y < height; ++y) memcpy(dst + y * width, row(y), sizeof(T) * width);
+    }
+
+    // only the dirty spans, the rest of dst already holds them
+    void store(T* dst, const Dirty_Rows& dirty) const {
+	for (size_t y = 0; y < height; ++y) {
+	    if (!dirty.is_dirty(y)) continue;
+	    memcpy(dst + y * width + dirty.begin[y], row(y) + dirty.begin[y], sizeof(T) * (dirty.end[y] - dirty.begin[y]));
+	}
+    }
+
+    // the halo rows, including their corners, so the halo elements of every row have to be
+    // filled before
+    void fill_halo_rows(Boundary boundary, T dead) {
+	T* top = row(-1) - 1;
+	T* bottom = row(height) - 1;
+	size_t span = width + 2;
+	switch (boundary) {
+	    case BOUNDARY_TORUS:
+		memcpy(top, row(height - 1) - 1, sizeof(T) * span);
+		memcpy(bottom, row(0) - 1, sizeof(T) * span);
+	    break;
+	    case BOUNDARY_MIRROR:
+		memcpy(top, row(0) - 1, sizeof(T) * span);
+		memcpy(bottom, row(height - 1) - 1, sizeof(T) * span);
+	    break;
+	    default:
+		for (size_t i = 0; i < span; ++i) top[i] = bottom[i] = dead;
+	}
+    }
+
+    // halo of a grid of cells, one element is one cell
+    void fill_halo(Boundary boundary, T dead) {
+	for (size_t y = 0; y < height; ++y) fill_cell_row_halo(row(y), width, boundary, dead);
+	fill_halo_rows(boundary, dead);
+    }
+};
+
+// halo of a row of width cells packed 64 per word, r[-1] and r[WORDS_FOR(width)] are the halo words.
+// if the width is not a multiple of 64 the bit after the last cell is the cell right of the row,
+// and the bits after it are cleared
+static void fill_bit_row_halo(u64* r, size_t width, Boundary boundary) {
+    size_t words = (width + 63) / 64;
+    size_t tail = width % 64;
+    u64 tail_mask = tail ? (u64(1) << tail) - 1 : ~u64(0);
+    u64 first = r[0] & 1;
+    u64 last = BIT_AT((width - 1) % 64, r[(width - 1) / 64]);
+    u64 left = 0;
+    u64 right = 0;
+    if (boundary == BOUNDARY_TORUS) {
+	left = last;
+	right = first;
+    }
+    else if (boundary == BOUNDARY_MIRROR) {
+	left = first;
+	right = last;
+    }
+    r[words - 1] &= tail_mask;
+    if (tail) r[words - 1] |= right << tail;
+    r[words] = tail ? 0 : right;
+    r[-1] = left << 63;
+}
+
+// halo of a grid of packed rows
+static void fill_bit_halo(Padded_Grid<u64>& grid, size_t width, Boundary boundary) {
+    for (size_t y = 0; y < grid.height; ++y) fill_bit_row_halo(grid.row(y), width, boundary);
+    grid.fill_halo_rows(boundary, 0);
+}
+
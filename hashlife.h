@@ -0,0 +1,442 @@
+#pragma once
+#include <cstring>
+#include <cassert>
+#include <utility>
+#include <vector>
+#include "common.h"
+#include "life_rule.h"
+
+// hashlife: the universe is a quadtree where equal subtrees are the same node,
+// and the RESULT of every node (its center advanced in time) is computed once.
+// a node of level k is 2^k cells wide, level 0 nodes are single cells.
+struct Hash_Node {
+    Hash_Node* nw;
+    Hash_Node* ne;
+    Hash_Node* sw;
+    Hash_Node* se;
+    // center 2^(k-1) square advanced min(2^(k-2), 2^step_log) generations
+    Hash_Node* result;
+    // chain of the hash table bucket, free list when the node is not used
+    Hash_Node* next;
+    u64 population;
+    u32 level;
+    u32 marked;
+};
+
+class Hash_Life {
+public:
+    Hash_Life(size_t max_nodes = 1 << 22) : max_nodes(max_nodes) {
+	// the leaves are on the heap like every other node, so they keep their address when the
+	// universe is moved and the hashes of the nodes above them stay valid
+	dead_leaf = new Hash_Node[2]();
+	alive_leaf = dead_leaf + 1;
+	alive_leaf->population = 1;
+    }
+
+    Hash_Life(const Hash_Life&) = delete;
+    Hash_Life& operator=(const Hash_Life&) = delete;
+
+    Hash_Life(Hash_Life&& other) : Hash_Life(other.max_nodes) {
+	swap(other);
+    }
+
+    // the nodes stay where they are, only the pointers to them change hands
+    Hash_Life& operator=(Hash_Life&& other) noexcept {
+	swap(other);
+	return *this;
+    }
+
+    ~Hash_Life() {
+	for (Hash_Node* block : blocks) delete[] block;
+	delete[] dead_leaf;
+    }
+
+    void swap(Hash_Life& other) noexcept {
+	std::swap(root, other.root);
+	std::swap(rule, other.rule);
+	std::swap(step_log, other.step_log);
+	std::swap(generation, other.generation);
+	std::swap(node_count, other.node_count);
+	std::swap(max_nodes, other.max_nodes);
+	std::swap(dead_leaf, other.dead_leaf);
+	std::swap(alive_leaf, other.alive_leaf);
+	buckets.swap(other.buckets);
+	empty_nodes.swap(other.empty_nodes);
+	blocks.swap(other.blocks);
+	std::swap(free_list, other.free_list);
+    }
+
+    Hash_Node* root = NULL;
+    // B0 rules would fill the infinite plane, they are not supported
+    Life_Rule rule;
+    // the next advance() moves 2^step_log generations forward
+    int step_log = 0;
+    u64 generation = 0;
+    size_t node_count = 0;
+    // collect_garbage() runs after a step once the cache holds more nodes than this
+    size_t max_nodes;
+
+    void clear() {
+	if (buckets.empty()) buckets.resize(1 << 16, NULL);
+	root = empty_node(3);
+	generation = 0;
+    }
+
+    void set_step_log(int k) {
+	assert(k >= 0 && k < 62);
+	if (k == step_log) return;
+	step_log = k;
+	// memoized results are only valid for the step they were computed with
+	for (Hash_Node* n : all_nodes()) n->result = NULL;
+    }
+
+    void set_rule(const Life_Rule& new_rule) {
+	assert(!new_rule.births_from_nothing() && "hashlife can not run B0 rules");
+	if (new_rule == rule) return;
+	rule = new_rule;
+	for (Hash_Node* n : all_nodes()) n->result = NULL;
+    }
+
+    u64 population() {
+	return root ? root->population : 0;
+    }
+
+    // world coordinates are centered on the root
+    bool get_cell(long x, long y) {
+	if (!root) return false;
+	long half = 1L << (root->level - 1);
+	if (x < -half || y < -half || x >= half || y >= half) return false;
+	Hash_Node* n = root;
+	x += half;
+	y += half;
+	while (n->level > 0) {
+	    long h = 1L << (n->level - 1);
+	    n = quadrant(n, x >= h, y >= h);
+	    x &= h - 1;
+	    y &= h - 1;
+	}
+	return n == alive_leaf;
+    }
+
+    void set_cell(long x, long y, bool alive) {
+	if (!root) clear();
+	while (!contains(x, y)) root = expand(root);
+	long half = 1L << (root->level - 1);
+	root = set_cell(root, x + half, y + half, alive);
+    }
+
+    // the flat grid is centered on the origin of the universe, the generation stays
+    template<typename T> void load(const T* cells, size_t width, size_t height, T one) {
+	u64 kept = generation;
+	clear();
+	generation = kept;
+	long extent = width > height ? width : height;
+	while ((1L << (root->level - 1)) < extent) root = empty_node(root->level + 1);
+	long half = 1L << (root->level - 1);
+	root = build(root->level, -half, -half, cells, width, height, one);
+    }
+
+    template<typename T> void store(T* cells, size_t width, size_t height, T zero, T one) {
+	store_region(cells, -(long)width / 2, -(long)height / 2, width, height, zero, one);
+    }
+
+    // any width x height window of the universe with its top left cell at left, top.
+    // empty nodes are skipped, so the cost is the live part of the window
+    template<typename T> void store_region(T* cells, long left, long top, size_t width, size_t height, T zero, T one) {
+	for (size_t i = 0; i < width * height; ++i) cells[i] = zero;
+	if (!root) return;
+	long half = 1L << (root->level - 1);
+	write(root, -half, -half, cells, left, top, width, height, one);
+    }
+
+    // building blocks for readers of quadtree formats, equal nodes come out as the same node
+    Hash_Node* leaf(bool alive) {
+	return alive ? alive_leaf : dead_leaf;
+    }
+
+    Hash_Node* empty(u32 level) {
+	if (buckets.empty()) clear();
+	return empty_node(level);
+    }
+
+    Hash_Node* node(Hash_Node* nw, Hash_Node* ne, Hash_Node* sw, Hash_Node* se) {
+	assert(nw->level == ne->level && nw->level == sw->level && nw->level == se->level);
+	if (buckets.empty()) clear();
+	return find_node(nw, ne, sw, se);
+    }
+
+    // replaces the universe, the center of n is the origin
+    void set_root(Hash_Node* n, u64 new_generation) {
+	assert(n->level >= 1);
+	root = n;
+	generation = new_generation;
+	// a big pattern would otherwise be collected after every step
+	if (node_count * 2 > max_nodes) max_nodes = node_count * 2;
+    }
+
+    void advance() {
+	if (!root) clear();
+	// the pattern has to stay inside the result square, so it is grown until the
+	// live cells sit in the central quarter and the root is big enough for the step
+	while (root->level < (u32)step_log + 3 || !centered(root)) root = expand(root);
+	root = expand(root);
+	root = result(root);
+	generation += u64(1) << step_log;
+	if (node_count > max_nodes) {
+	    collect_garbage();
+	    // a growing pattern would otherwise lose its memo on every step
+	    if (node_count * 2 > max_nodes) max_nodes = node_count * 2;
+	}
+    }
+
+    // frees every node not reachable from the root or the empty nodes
+    void collect_garbage() {
+	if (root) mark(root);
+	for (Hash_Node* n : empty_nodes) mark(n);
+	for (Hash_Node* n : all_nodes()) {
+	    if (n->marked && n->result && !n->result->marked) n->result = NULL;
+	}
+	for (size_t b = 0; b < buckets.size(); ++b) {
+	    Hash_Node** link = &buckets[b];
+	    while (*link) {
+		Hash_Node* n = *link;
+		if (n->marked) {
+		    n->marked = 0;
+		    link = &n->next;
+		}
+		else {
+		    *link = n->next;
+		    n->next = free_list;
+		    free_list = n;
+		    node_count--;
+		}
+	    }
+	}
+    }
+
+private:
+    Hash_Node* dead_leaf;
+    Hash_Node* alive_leaf;
+    std::vector<Hash_Node*> buckets;
+    std::vector<Hash_Node*> empty_nodes;
+    std::vector<Hash_Node*> blocks;
+    Hash_Node* free_list = NULL;
+    static constexpr size_t block_size = 4096;
+
+    static size_t hash(Hash_Node* nw, Hash_Node* ne, Hash_Node* sw, Hash_Node* se) {
+	u64 h = (u64)nw * 0x9E3779B97F4A7C15ull;
+	h = (h ^ (h >> 29) ^ (u64)ne) * 0xBF58476D1CE4E5B9ull;
+	h = (h ^ (h >> 31) ^ (u64)sw) * 0x94D049BB133111EBull;
+	h = (h ^ (h >> 29) ^ (u64)se) * 0x9E3779B97F4A7C15ull;
+	return h ^ (h >> 32);
+    }
+
+    std::vector<Hash_Node*> all_nodes() {
+	std::vector<Hash_Node*> nodes;
+	nodes.reserve(node_count);
+	for (Hash_Node* n : buckets) {
+	    for (; n; n = n->next) nodes.push_back(n);
+	}
+	return nodes;
+    }
+
+    Hash_Node* allocate() {
+	if (!free_list) {
+	    Hash_Node* block = new Hash_Node[block_size];
+	    blocks.push_back(block);
+	    for (size_t i = 0; i < block_size; ++i) {
+		block[i].next = free_list;
+		free_list = &block[i];
+	    }
+	}
+	Hash_Node* n = free_list;
+	free_list = n->next;
+	return n;
+    }
+
+    void grow_table() {
+	std::vector<Hash_Node*> old;
+	old.swap(buckets);
+	buckets.resize(old.size() * 2, NULL);
+	for (Hash_Node* n : old) {
+	    while (n) {
+		Hash_Node* next = n->next;
+		size_t b = hash(n->nw, n->ne, n->sw, n->se) & (buckets.size() - 1);
+		n->next = buckets[b];
+		buckets[b] = n;
+		n = next;
+	    }
+	}
+    }
+
+    // the canonical node with these children
+    Hash_Node* find_node(Hash_Node* nw, Hash_Node* ne, Hash_Node* sw, Hash_Node* se) {
+	size_t b = hash(nw, ne, sw, se) & (buckets.size() - 1);
+	for (Hash_Node* n = buckets[b]; n; n = n->next) {
+	    if (n->nw == nw && n->ne == ne && n->sw == sw && n->se == se) return n;
+	}
+	if (node_count > buckets.size()) {
+	    grow_table();
+	    b = hash(nw, ne, sw, se) & (buckets.size() - 1);
+	}
+	Hash_Node* n = allocate();
+	n->nw = nw;
+	n->ne = ne;
+	n->sw = sw;
+	n->se = se;
+	n->result = NULL;
+	n->population = nw->population + ne->population + sw->population + se->population;
+	n->level = nw->level + 1;
+	n->marked = 0;
+	n->next = buckets[b];
+	buckets[b] = n;
+	node_count++;
+	return n;
+    }
+
+    Hash_Node* empty_node(u32 level) {
+	if (level == 0) return dead_leaf;
+	while (empty_nodes.size() < level) {
+	    Hash_Node* e = empty_node(empty_nodes.size());
+	    empty_nodes.push_back(find_node(e, e, e, e));
+	}
+	return empty_nodes[level - 1];
+    }
+
+    static Hash_Node* quadrant(Hash_Node* n, bool east, bool south) {
+	if (south) return east ? n->se : n->sw;
+	return east ? n->ne : n->nw;
+    }
+
+    bool contains(long x, long y) {
+	long half = 1L << (root->level - 1);
+	return x >= -half && y >= -half && x < half && y < half;
+    }
+
+    // x and y are relative to the top left corner of the node
+    Hash_Node* set_cell(Hash_Node* n, long x, long y, bool alive) {
+	if (n->level == 0) return alive ? alive_leaf : dead_leaf;
+	long h = 1L << (n->level - 1);
+	Hash_Node* q[4] = {n->nw, n->ne, n->sw, n->se};
+	int i = (x >= h) + 2 * (y >= h);
+	q[i] = set_cell(q[i], x & (h - 1), y & (h - 1), alive);
+	return find_node(q[0], q[1], q[2], q[3]);
+    }
+
+    // twice as wide, the old root ends up in the middle
+    Hash_Node* expand(Hash_Node* n) {
+	Hash_Node* e = empty_node(n->level - 1);
+	return find_node(find_node(e, e, e, n->nw), find_node(e, e, n->ne, e),
+			 find_node(e, n->sw, e, e), find_node(n->se, e, e, e));
+    }
+
+    // true if only the four grandchildren around the center hold live cells
+    bool centered(Hash_Node* n) {
+	u64 inner = n->nw->se->population + n->ne->sw->population + n->sw->ne->population + n->se->nw->population;
+	return inner == n->population;
+    }
+
+    Hash_Node* center(Hash_Node* n) {
+	return find_node(n->nw->se, n->ne->sw, n->sw->ne, n->se->nw);
+    }
+
+    // level 2 nodes are 4x4 cells, their result is the inner 2x2 after one generation
+    Hash_Node* base_result(Hash_Node* n) {
+	int grid[4][4];
+	for (int y = 0; y < 4; ++y) {
+	    for (int x = 0; x < 4; ++x) {
+		Hash_Node* q = quadrant(quadrant(n, x >= 2, y >= 2), x & 1, y & 1);
+		grid[y][x] = q == alive_leaf;
+	    }
+	}
+	Hash_Node* out[4];
+	for (int y = 1; y <= 2; ++y) {
+	    for (int x = 1; x <= 2; ++x) {
+		int neighbours = 0;
+		for (int dy = -1; dy <= 1; ++dy) {
+		    for (int dx = -1; dx <= 1; ++dx) {
+			if (dx || dy) neighbours += grid[y + dy][x + dx];
+		    }
+		}
+		bool alive = rule.next_state(grid[y][x], neighbours);
+		out[(x - 1) + 2 * (y - 1)] = alive ? alive_leaf : dead_leaf;
+	    }
+	}
+	return find_node(out[0], out[1], out[2], out[3]);
+    }
+
+    Hash_Node* result(Hash_Node* n) {
+	if (n->result) return n->result;
+	if (n->population == 0) {
+	    n->result = empty_node(n->level - 1);
+	    return n->result;
+	}
+	if (n->level == 2) {
+	    n->result = base_result(n);
+	    return n->result;
+	}
+	// the nine overlapping sub squares one level down
+	Hash_Node* sub[9] = {
+	    n->nw,
+	    find_node(n->nw->ne, n->ne->nw, n->nw->se, n->ne->sw),
+	    n->ne,
+	    find_node(n->nw->sw, n->nw->se, n->sw->nw, n->sw->ne),
+	    center(n),
+	    find_node(n->ne->sw, n->ne->se, n->se->nw, n->se->ne),
+	    n->sw,
+	    find_node(n->sw->ne, n->se->nw, n->sw->se, n->se->sw),
+	    n->se,
+	};
+	// full speed does both halves of the step in the recursion, otherwise
+	// the first half only takes the centers and the time step stays at 2^step_log
+	bool full_speed = (int)n->level - 2 <= step_log;
+	Hash_Node* r[9];
+	for (int i = 0; i < 9; ++i) r[i] = full_speed ? result(sub[i]) : center(sub[i]);
+	n->result = find_node(result(find_node(r[0], r[1], r[3], r[4])),
+			      result(find_node(r[1], r[2], r[4], r[5])),
+			      result(find_node(r[3], r[4], r[6], r[7])),
+			      result(find_node(r[4], r[5], r[7], r[8])));
+	return n->result;
+    }
+
+    void mark(Hash_Node* n) {
+	if (n->level == 0 || n->marked) return;
+	n->marked = 1;
+	mark(n->nw);
+	mark(n->ne);
+	mark(n->sw);
+	mark(n->se);
+    }
+
+    template<typename T> Hash_Node* build(u32 level, long x0, long y0, const T* cells, size_t width, size_t height, T one) {
+	long size = 1L << level;
+	long left = -(long)width / 2;
+	long top = -(long)height / 2;
+	if (x0 + size <= left || y0 + size <= top || x0 >= left + (long)width || y0 >= top + (long)height) {
+	    return empty_node(level);
+	}
+	if (level == 0) {
+	    return cells[INDEX(x0 - left, y0 - top, (long)width)] == one ? alive_leaf : dead_leaf;
+	}
+	long h = size / 2;
+	return find_node(build(level - 1, x0, y0, cells, width, height, one),
+			 build(level - 1, x0 + h, y0, cells, width, height, one),
+			 build(level - 1, x0, y0 + h, cells, width, height, one),
+			 build(level - 1, x0 + h, y0 + h, cells, width, height, one));
+    }
+
+    template<typename T> void write(Hash_Node* n, long x0, long y0, T* cells, long left, long top, size_t width, size_t height, T one) {
+	long size = 1L << n->level;
+	if (n->population == 0) return;
+	if (x0 + size <= left || y0 + size <= top || x0 >= left + (long)width || y0 >= top + (long)height) return;
+	if (n->level == 0) {
+	    cells[INDEX(x0 - left, y0 - top, (long)width)] = one;
+	    return;
+	}
+	long h = size / 2;
+	write(n->nw, x0, y0, cells, left, top, width, height, one);
+	write(n->ne, x0 + h, y0, cells, left, top, width, height, one);
+	write(n->sw, x0, y0 + h, cells, left, top, width, height, one);
+	write(n->se, x0 + h, y0 + h, cells, left, top, width, height, one);
+    }
+};
@@ -0,0 +1,446 @@
+#include "cell_automata.h"
+#include "macrocell.h"
+#include "rle.h"
+#include "snapshot.h"
+#include "soup_search.h"
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+// runs one automat without a window at full engine speed and prints the timing and the
+// hash of the final state, for batch runs on machines without a display.
+// --verify instead runs random soups through every engine and compares them with the
+// reference engine after every generation
+
+struct Options {
+    Automata_Type type = TWO_DIM;
+    size_t width = 256;
+    size_t height = 256;
+    const char* rule = NULL;
+    Engine engine = BIT_ENGINE;
+    Boundary boundary = BOUNDARY_TORUS;
+    // hashlife only mentions the boundary it ignores if it was asked for
+    bool boundary_set = false;
+    u64 seed = 0;
+    bool seeded = false;
+    // alive fraction of the random soups
+    double density = 0.5;
+    u64 generations = 1000;
+    size_t threads = std::thread::hardware_concurrency();
+    bool streaming = false;
+    int hashlife_step_log = 0;
+    u64 hash_every = 0;
+    // stops at the first generation the run repeats
+    bool until_cycle = false;
+    u64 max_period = 1024;
+    const char* output = NULL;
+    const char* input = NULL;
+    bool verify = false;
+    u64 soups = 16;
+    bool search = false;
+    size_t soup_size = 16;
+    const char* census = NULL;
+};
+
+static const char* engine_names[ENGINE_MAX] = {"reference", "bit", "hashlife"};
+
+void usage() {
+    fprintf(stderr,
+	"usage: cell_automata_headless [options]\n"
+	"  --type 1d|2d                      (2d)\n"
+	"  --width N, --height N             (256 x 256)\n"
+	"  --rule R                          rulestring like B3/S23 for 2d, wolfram number for 1d\n"
+	"  --engine reference|bit|hashlife   (bit)\n"
+	"  --boundary torus|dead|mirror      (torus)\n"
+	"  --seed N                          seed of the random soup (the time)\n"
+	"  --density D                       alive fraction of the random soup (0.5)\n"
+	"  --generations N                   (1000)\n"
+	"  --threads N                       (all cores)\n"
+	"  --streaming                       1d keeps going after height generations\n"
+	"  --hashlife-step LOG               hashlife jumps 2^LOG generations per step\n"
+	"  --hash-every N                    prints the hash every N generations\n"
+	"  --until-cycle                     stops once the state repeats, --generations is the limit\n"
+	"  --max-period N                    longest cycle --until-cycle finds (1024)\n"
+	"  --input PATH                      starts from an .rle or .mc pattern or a .casnap snapshot instead of a random soup\n"
+	"  --output PATH                     final state as .rle, .mc or .casnap, otherwise as plaintext (.cells), - for stdout\n"
+	"  --verify                          compares every engine with the reference engine on random soups\n"
+	"  --soups N                         soups of --verify or --search, seeds from --seed on (16)\n"
+	"  --search                          runs 2d soups until they repeat and counts the objects they leave\n"
+	"  --soup-size N                     side of the soups of --search (16)\n"
+	"  --census PATH                     writes the census of --search, most common objects first\n");
+}
+
+bool parse_u64(const char* s, u64& out) {
+    char* end = NULL;
+    out = strtoull(s, &end, 10);
+    return end != s && *end == '\0';
+}
+
+// a fraction from 0 to 1
+bool parse_fraction(const char* s, double& out) {
+    char* end = NULL;
+    out = strtod(s, &end);
+    return end != s && *end == '\0' && out >= 0.0 && out <= 1.0;
+}
+
+template<size_t N> bool parse_name(const char* s, const char* (&names)[N], int& out) {
+    for (size_t i = 0; i < N; ++i) {
+	if (!strcmp(s, names[i])) {
+	    out = i;
+	    return true;
+	}
+    }
+    return false;
+}
+
+bool parse_options(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+	const char* arg = argv[i];
+	const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+	u64 number = 0;
+	double fraction = 0.0;
+	int index = 0;
+	if (!strcmp(arg, "--help")) return false;
+	if (!strcmp(arg, "--streaming")) {
+	    options.streaming = true;
+	    continue;
+	}
+	if (!strcmp(arg, "--verify")) {
+	    options.verify = true;
+	    continue;
+	}
+	if (!strcmp(arg, "--search")) {
+	    options.search = true;
+	    continue;
+	}
+	if (!strcmp(arg, "--until-cycle")) {
+	    options.until_cycle = true;
+	    continue;
+	}
+	if (!value) {
+	    fprintf(stderr, "%s needs a value\n", arg);
+	    return false;
+	}
+	i++;
+	if (!strcmp(arg, "--type")) {
+	    if (!strcmp(value, "1d")) options.type = ONE_DIM;
+	    else if (!strcmp(value, "2d")) options.type = TWO_DIM;
+	    else return false;
+	}
+	else if (!strcmp(arg, "--width") && parse_u64(value, number) && number > 0) options.width = number;
+	else if (!strcmp(arg, "--height") && parse_u64(value, number) && number > 0) options.height = number;
+	else if (!strcmp(arg, "--rule")) options.rule = value;
+	else if (!strcmp(arg, "--engine") && parse_name(value, engine_names, index)) options.engine = (Engine)index;
+	else if (!strcmp(arg, "--boundary") && parse_name(value, boundary_names, index)) {
+	    options.boundary = (Boundary)index;
+	    options.boundary_set = true;
+	}
+	else if (!strcmp(arg, "--seed") && parse_u64(value, number)) {
+	    options.seed = number;
+	    options.seeded = true;
+	}
+	else if (!strcmp(arg, "--density") && parse_fraction(value, fraction)) options.density = fraction;
+	else if (!strcmp(arg, "--generations") && parse_u64(value, number)) options.generations = number;
+	else if (!strcmp(arg, "--threads") && parse_u64(value, number) && number > 0) options.threads = number;
+	else if (!strcmp(arg, "--hashlife-step") && parse_u64(value, number) && number < 64) options.hashlife_step_log = number;
+	else if (!strcmp(arg, "--hash-every") && parse_u64(value, number)) options.hash_every = number;
+	else if (!strcmp(arg, "--max-period") && parse_u64(value, number) && number > 0) options.max_period = number;
+	else if (!strcmp(arg, "--output")) options.output = value;
+	else if (!strcmp(arg, "--input")) options.input = value;
+	else if (!strcmp(arg, "--soups") && parse_u64(value, number)) options.soups = number;
+	else if (!strcmp(arg, "--soup-size") && parse_u64(value, number) && number > 0) options.soup_size = number;
+	else if (!strcmp(arg, "--census")) options.census = value;
+	else {
+	    fprintf(stderr, "bad option %s %s\n", arg, value);
+	    return false;
+	}
+    }
+    return true;
+}
+
+// what --until-cycle compares: the whole grid of 2D automats, the row of the current
+// generation of 1D ones. only the rows that changed since the last hash are hashed again
+u64 cycle_hash(Cell_Automat<u8>& automat, State_Hash<u8>& state_hash) {
+    const u8* cells = automat.sync_cells();
+    if (automat.type == ONE_DIM) return hash_row(cells + (automat.generation % automat.height) * automat.width, automat.width);
+    u64 hash = state_hash.update(cells, automat.dirty);
+    automat.dirty.clear();
+    return hash;
+}
+
+bool has_extension(const char* path, const char* extension) {
+    size_t length = strlen(path);
+    size_t extension_length = strlen(extension);
+    return length >= extension_length && !strcmp(path + length - extension_length, extension);
+}
+
+// the plaintext format of life pattern collections, rows in generation order
+bool write_plaintext(Cell_Automat<u8>& automat, const char* path) {
+    FILE* file = strcmp(path, "-") ? fopen(path, "w") : stdout;
+    if (!file) {
+	fprintf(stderr, "could not open %s for writing\n", path);
+	return false;
+    }
+    const u8* cells = automat.sync_cells();
+    fprintf(file, "!generation %zu\n", automat.generation);
+    std::vector<char> line(automat.width + 1, '\n');
+    for (size_t r = 0; r < automat.height; ++r) {
+	const u8* row = cells + ((automat.first_row() + r) % automat.height) * automat.width;
+	for (size_t x = 0; x < automat.width; ++x) line[x] = row[x] == automat.one ? 'O' : '.';
+	fwrite(line.data(), 1, line.size(), file);
+    }
+    if (file != stdout) fclose(file);
+    return true;
+}
+
+bool setup(Cell_Automat<u8>& automat, const Options& options, Engine engine, Thread_Pool& pool) {
+    automat.set_engine(engine);
+    // --verify stands in for the plane with a dead margin on purpose
+    if (!automat.set_boundary(options.boundary) && options.boundary_set && !options.verify) {
+	fprintf(stderr, "hashlife has no boundary, the %s boundary is ignored\n", boundary_names[options.boundary]);
+    }
+    if (options.type == TWO_DIM) {
+	const char* rule = options.rule ? options.rule : "B3/S23";
+	if (!automat.set_ruleset(rule)) {
+	    fprintf(stderr, "invalid rule %s, expected something like B3/S23\n", rule);
+	    return false;
+	}
+	if (automat.hashlife_fallback()) fprintf(stderr, "hashlife can not run B0 rules, using the reference rules\n");
+    }
+    else {
+	u64 rule = 30;
+	if (options.rule && (!parse_u64(options.rule, rule) || rule > 255)) {
+	    fprintf(stderr, "1d rules are wolfram numbers from 0 to 255\n");
+	    return false;
+	}
+	automat.set_ruleset_dec(rule);
+	automat.set_streaming(options.streaming);
+    }
+    automat.hashlife.set_step_log(options.hashlife_step_log);
+    automat.set_thread_pool(&pool);
+    return true;
+}
+
+// prints the first cell where automat, run by the engine called name, differs from reference
+void report_difference(Cell_Automat<u8>& reference, Cell_Automat<u8>& automat, const char* name, u64 seed) {
+    const u8* expected = reference.sync_cells();
+    const u8* cells = automat.sync_cells();
+    for (size_t i = 0; i < reference.size; ++i) {
+	if (cells[i] == expected[i]) continue;
+	printf("seed %" PRIu64 " generation %zu: %s engine differs from the reference engine at cell %zu, %zu: %d instead of %d\n",
+	       seed, reference.generation, name, i % reference.width, i / reference.width, cells[i], expected[i]);
+	return;
+    }
+    printf("seed %" PRIu64 " generation %zu: %s engine has a different hash but the same cells\n",
+	   seed, reference.generation, name);
+}
+
+int verify(const Options& options) {
+    // the bit engine runs twice, the second time on the scalar kernels the vector ones have to match
+    std::vector<Engine> engines = {REFERENCE_ENGINE, BIT_ENGINE, BIT_ENGINE};
+    std::vector<const char*> names = {engine_names[REFERENCE_ENGINE], engine_names[BIT_ENGINE], "bit scalar"};
+    const size_t scalar_bits = 2;
+    // hashlife has no boundary, a dead margin the soup can not reach in time stands in for the plane
+    bool hashlife = options.type == TWO_DIM && options.boundary == BOUNDARY_DEAD;
+    size_t margin = 0;
+    // hashlife jumps 2^k generations per step, the other engines step as often to catch up
+    u64 step = hashlife ? u64(1) << options.hashlife_step_log : 1;
+    if (hashlife) {
+	engines.push_back(HASHLIFE_ENGINE);
+	names.push_back(engine_names[HASHLIFE_ENGINE]);
+	// the last step can go past --generations
+	margin = (options.generations + step - 1) / step * step;
+	margin++;
+    }
+    else if (options.type == TWO_DIM) printf("hashlife is only compared with --boundary dead\n");
+    size_t width = options.width + 2 * margin;
+    size_t height = options.type == TWO_DIM ? options.height + 2 * margin : options.height;
+    Thread_Pool pool(options.threads);
+    u64 first_seed = options.seeded ? options.seed : time(NULL);
+
+    for (u64 soup = 0; soup < options.soups; ++soup) {
+	u64 seed = first_seed + soup;
+	std::vector<Cell_Automat<u8>*> automats;
+	std::vector<State_Hash<u8>> hashes(engines.size());
+	// 1d soups are the first row, 2d soups the center without the margin.
+	// the fill only depends on the seed, so every engine gets the same soup
+	size_t soup_height = options.type == TWO_DIM ? options.height : 1;
+	for (size_t e = 0; e < engines.size(); ++e) {
+	    automats.push_back(new Cell_Automat<u8>(options.type, width, height, 0, 1));
+	    if (!setup(*automats[e], options, engines[e], pool)) return 1;
+	    if (e == scalar_bits) {
+		automats[e]->bits.set_simd_level(SIMD_SCALAR);
+		automats[e]->elementary.set_simd_level(SIMD_SCALAR);
+	    }
+	    automats[e]->random_seed = seed;
+	    automats[e]->randomize_rect(margin, margin, margin + options.width, margin + soup_height, options.density);
+	    hashes[e].init(width, height);
+	}
+
+	bool failed = false;
+	while (!failed && automats[0]->generation < options.generations) {
+	    size_t generation = automats[0]->generation;
+	    for (Cell_Automat<u8>* automat : automats) {
+		if (automat->uses_hashlife()) {
+		    automat->apply_rules();
+		    continue;
+		}
+		for (u64 i = 0; i < step; ++i) automat->apply_rules();
+	    }
+	    // a full bounded 1d automat
+	    if (automats[0]->generation == generation) break;
+	    for (size_t e = 0; e < automats.size(); ++e) {
+		hashes[e].update(automats[e]->sync_cells(), automats[e]->dirty);
+		automats[e]->dirty.clear();
+		if (e == 0) continue;
+		if (automats[e]->generation != automats[0]->generation) {
+		    printf("seed %" PRIu64 ": %s engine is at generation %zu, the reference engine at %zu\n",
+			   seed, names[e], automats[e]->generation, automats[0]->generation);
+		    failed = true;
+		}
+		else if (hashes[e].value != hashes[0].value) {
+		    report_difference(*automats[0], *automats[e], names[e], seed);
+		    failed = true;
+		}
+	    }
+	}
+	// a hash collision can not hide a difference at the end
+	for (size_t e = 1; e < automats.size() && !failed; ++e) {
+	    if (memcmp(automats[0]->sync_cells(), automats[e]->sync_cells(), width * height)) {
+		report_difference(*automats[0], *automats[e], names[e], seed);
+		failed = true;
+	    }
+	}
+	if (!failed) {
+	    printf("seed %" PRIu64 ": %zu generations, hash %016" PRIx64 " on", seed, automats[0]->generation, hashes[0].value);
+	    for (const char* name : names) printf(" %s", name);
+	    printf("\n");
+	}
+	for (Cell_Automat<u8>* automat : automats) delete automat;
+	if (failed) return 1;
+    }
+    return 0;
+}
+
+// soups per second per core is what the search is measured in
+int search(const Options& options) {
+    Soup_Search search;
+    if (options.rule && !search.rule.parse(options.rule)) {
+	fprintf(stderr, "invalid rule %s\n", options.rule);
+	return 1;
+    }
+    if (search.rule.births_from_nothing()) {
+	fprintf(stderr, "B0 rules have no ash to search\n");
+	return 1;
+    }
+    search.seed = options.seeded ? options.seed : time(NULL);
+    search.options.soup_size = options.soup_size;
+    search.options.max_period = options.max_period;
+    auto start = std::chrono::steady_clock::now();
+    search.run(options.soups, options.threads);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    u64 soups = search.soups_done;
+    printf("search rule %s seed %" PRIu64 " soup %zux%zu threads %zu\n", search.rule.to_string().c_str(), search.seed,
+	   options.soup_size, options.soup_size, options.threads);
+    printf("soups %" PRIu64 " seconds %.3f soups_per_s %.1f soups_per_s_per_core %.1f gens_per_soup %.1f\n", soups, seconds,
+	   soups / seconds, soups / seconds / options.threads, soups ? (double)search.generations / soups : 0.0);
+    std::vector<std::pair<std::string, u64>> entries = search.census.sorted();
+    printf("objects %" PRIu64 " distinct %zu\n", search.census.total(), entries.size());
+    for (size_t i = 0; i < entries.size() && i < 20; ++i) printf("%12" PRIu64 " %s\n", entries[i].second, entries[i].first.c_str());
+    if (options.census) {
+	FILE* file = fopen(options.census, "w");
+	if (!file) {
+	    fprintf(stderr, "could not open %s for writing\n", options.census);
+	    return 1;
+	}
+	fprintf(file, "# rule %s seed %" PRIu64 " soups %" PRIu64 "\n", search.rule.to_string().c_str(), search.seed, soups);
+	for (auto& entry : entries) fprintf(file, "%s %" PRIu64 "\n", entry.first.c_str(), entry.second);
+	fclose(file);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+	usage();
+	return 1;
+    }
+    if (options.verify) return verify(options);
+    if (options.search) return search(options);
+
+    Cell_Automat<u8> automat(options.type, options.width, options.height, 0, 1);
+    Thread_Pool pool(options.threads);
+    if (!setup(automat, options, options.engine, pool)) return 1;
+    if (!options.seeded) options.seed = time(NULL);
+    automat.random_seed = options.seed;
+    if (!options.input) automat.randomize_cells(options.density);
+    else if (has_extension(options.input, ".mc")) {
+	if (options.type != TWO_DIM || !load_macrocell(automat, options.input)) return 1;
+    }
+    // a snapshot brings its own type, size, rule and boundary
+    else if (has_extension(options.input, ".casnap")) {
+	if (!load_snapshot(automat, options.input)) return 1;
+	options.type = automat.type;
+    }
+    else if (!load_rle(automat, options.input)) return 1;
+
+    printf("type %s width %zu height %zu rule %s engine %s boundary %s seed %" PRIu64 " threads %zu\n",
+	   options.type == ONE_DIM ? "1d" : "2d", automat.width, automat.height,
+	   options.type == ONE_DIM ? std::to_string(automat.one_dim_rules).c_str() : automat.life_rule.to_string().c_str(),
+	   engine_names[automat.engine], boundary_names[automat.boundary], options.seed, pool.threads());
+
+    // the hashes in between are not timed, they only rehash the rows that changed
+    State_Hash<u8> state_hash;
+    state_hash.init(automat.width, automat.height);
+    double seconds = 0.0;
+    // snapshots and macrocells go on from their generation
+    size_t first_generation = automat.generation;
+    size_t last_generation = first_generation + options.generations;
+    u64 next_hash = first_generation + options.hash_every;
+    Cycle_Detector cycles;
+    cycles.max_period = options.max_period;
+    if (options.until_cycle) cycles.observe(cycle_hash(automat, state_hash), automat.generation);
+    while (automat.generation < last_generation) {
+	size_t generation = automat.generation;
+	auto start = std::chrono::steady_clock::now();
+	automat.apply_rules();
+	seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (automat.generation == generation) {
+	    printf("stopped at generation %zu, the 1d automat is full (see --streaming)\n", generation);
+	    break;
+	}
+	if (options.hash_every && automat.generation >= next_hash) {
+	    printf("generation %zu hash %016" PRIx64 "\n", automat.generation, state_hash.update(automat.sync_cells(), automat.dirty));
+	    automat.dirty.clear();
+	    next_hash = automat.generation + options.hash_every;
+	}
+	if (options.until_cycle && cycles.observe(cycle_hash(automat, state_hash), automat.generation)) {
+	    printf("cycle period %" PRIu64 " from generation %" PRIu64 "\n", cycles.period, cycles.start);
+	    break;
+	}
+    }
+    if (options.until_cycle && !cycles.period) printf("no cycle up to generation %zu\n", automat.generation);
+
+    // a 1d generation is one row
+    size_t generations = automat.generation - first_generation;
+    double cells = (double)automat.width * (options.type == ONE_DIM ? 1 : automat.height) * generations;
+    printf("generations %zu seconds %.6f ms_per_gen %.6f gens_per_s %.1f cells_per_s %.4g\n",
+	   generations, seconds, generations ? seconds * 1e3 / generations : 0.0,
+	   seconds > 0.0 ? generations / seconds : 0.0, seconds > 0.0 ? cells / seconds : 0.0);
+    printf("hash %016" PRIx64 " population %zu\n", automat.hash_cells(), automat.population());
+
+    if (options.output) {
+	bool ok = false;
+	if (has_extension(options.output, ".rle")) ok = save_rle(automat, options.output);
+	else if (has_extension(options.output, ".mc") && options.type == TWO_DIM) ok = save_macrocell(automat, options.output);
+	else if (has_extension(options.output, ".casnap")) ok = save_snapshot(automat, options.output);
+	else ok = write_plaintext(automat, options.output);
+	if (!ok) return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,264 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <cassert>
+#include "common.h"
+#include "life_rule.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LIFE_X86
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#define LIFE_NEON
+#endif
+
+#define WORD_BITS 64
+#define WORDS_FOR(bits) (((bits) + WORD_BITS - 1) / WORD_BITS)
+
+// row kernels of the bit packed life-like and elementary automats.
+// every kernel reads rows with one halo word on each side (index -1 and words are valid)
+// and writes words cells of the next generation.
+// the scalar kernel is the reference, the vector ones have to produce the same bits.
+
+enum Simd_Level {
+    SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2, SIMD_NEON, SIMD_LEVEL_MAX
+};
+
+static const char* simd_level_names[SIMD_LEVEL_MAX] = {"scalar", "sse2", "avx2", "neon"};
+
+typedef void (*Life_Row_Func)(const u64* above, const u64* center, const u64* below, u64* out, size_t words, const Life_Rule& rule);
+typedef void (*Elementary_Row_Func)(const u64* in, u64* out, size_t words, u8 anf);
+
+// the kernels are written once with gcc vector extensions (u64 itself is the scalar case)
+// and compiled for every instruction set by inlining into a wrapper with the matching
+// target attribute.
+// loading at i - 1 and i + 1 gives the neighbouring words for the shifts, so no lane
+// shuffles are needed thanks to the halo words
+template<typename V> __attribute__((always_inline))
+static inline void load_words(V& v, const u64* p) {
+    memcpy(&v, p, sizeof(V));
+}
+
+// the row shifted so that every bit lines up with its left / right neighbour
+template<typename V> __attribute__((always_inline))
+static inline void load_neighbours(const u64* r, size_t i, V& left, V& mid, V& right) {
+    V before, after;
+    load_words(mid, r + i);
+    load_words(before, r + i - 1);
+    load_words(after, r + i + 1);
+    left = (mid << 1) | (before >> (WORD_BITS - 1));
+    right = (mid >> 1) | (after << (WORD_BITS - 1));
+}
+
+// adds three one bit numbers in every bit position of the words
+template<typename V> __attribute__((always_inline))
+static inline void full_add(const V& a, const V& b, const V& c, V& sum, V& carry) {
+    V t = a ^ b;
+    sum = t ^ c;
+    carry = (a & b) | (t & c);
+}
+
+// bit planes of the neighbour count of every cell, counted with a tree of adders
+template<typename V> __attribute__((always_inline))
+static inline void count_neighbours(const u64* above, const u64* center, const u64* below, size_t i,
+				    V& alive, V& ones, V& twos, V& fours, V& eights) {
+    V l, m, r;
+    V ones_a, twos_a, ones_c, twos_c;
+    load_neighbours(above, i, l, m, r);
+    full_add(l, m, r, ones_a, twos_a);
+    load_neighbours(below, i, l, m, r);
+    full_add(l, m, r, ones_c, twos_c);
+    load_neighbours(center, i, l, alive, r);
+    V ones_b = l ^ r, twos_b = l & r;
+
+    V carry, twos_partial, fours_a;
+    full_add(ones_a, ones_b, ones_c, ones, carry);
+    full_add(twos_a, twos_b, twos_c, twos_partial, fours_a);
+    twos = twos_partial ^ carry;
+    V fours_b = twos_partial & carry;
+    fours = fours_a ^ fours_b;
+    eights = fours_a & fours_b;
+}
+
+// CONWAY is the hand written B3/S23 circuit, otherwise the compiled sum of products of the rule
+template<typename V, bool CONWAY> __attribute__((always_inline))
+static inline void life_row_kernel(const u64* above, const u64* center, const u64* below, u64* out, size_t words, const Life_Rule& rule) {
+    constexpr size_t lanes = sizeof(V) / sizeof(u64);
+    const Rule_Term_Masks* terms = rule.term_masks.data();
+    size_t term_count = rule.term_masks.size();
+    size_t i = 0;
+    for (; i + lanes <= words; i += lanes) {
+	V in[RULE_INPUT_MAX];
+	count_neighbours(above, center, below, i, in[RULE_ALIVE], in[RULE_ONES], in[RULE_TWOS], in[RULE_FOURS], in[RULE_EIGHTS]);
+	V next;
+	if (CONWAY) {
+	    // alive next generation with exactly 3 neighbours, or 2 neighbours when already alive
+	    next = in[RULE_TWOS] & ~(in[RULE_FOURS] | in[RULE_EIGHTS]) & (in[RULE_ONES] | in[RULE_ALIVE]);
+	}
+	else {
+	    next = in[RULE_ALIVE] ^ in[RULE_ALIVE];
+	    for (size_t t = 0; t < term_count; ++t) {
+		V term = ~(in[RULE_ALIVE] ^ in[RULE_ALIVE]);
+		for (int k = 0; k < RULE_INPUT_MAX; ++k) term &= (in[k] ^ terms[t].flip[k]) | terms[t].ignore[k];
+		next |= term;
+	    }
+	}
+	memcpy(out + i, &next, sizeof(V));
+    }
+    // the words left over by the vector loop
+    if constexpr (lanes > 1) {
+	if (i < words) life_row_kernel<u64, CONWAY>(above + i, center + i, below + i, out + i, words - i, rule);
+    }
+}
+
+// wolfram rule as an xor of and terms (algebraic normal form) over the left, center and
+// right cell. bit m of the result is set if the term made of the inputs in m is part of it,
+// with the inputs numbered like in the rule index (4 = left, 2 = center, 1 = right).
+// e.g. rule 30 is left ^ center ^ right ^ (center & right), the same as left ^ (center | right)
+static u8 elementary_anf(u8 rule) {
+    u8 anf = rule;
+    for (int input = 1; input < 8; input <<= 1) {
+	for (int m = 0; m < 8; ++m) {
+	    if (m & input) anf ^= BIT_AT(m ^ input, anf) << m;
+	}
+    }
+    return anf;
+}
+
+// next row of an elementary automat from the row in, 64 cells per word
+template<typename V> __attribute__((always_inline))
+static inline void elementary_row_kernel(const u64* in, u64* out, size_t words, u8 anf) {
+    constexpr size_t lanes = sizeof(V) / sizeof(u64);
+    size_t i = 0;
+    for (; i + lanes <= words; i += lanes) {
+	V l, c, r;
+	load_neighbours(in, i, l, c, r);
+	V next = c ^ c;
+	for (int m = 0; m < 8; ++m) {
+	    if (!BIT_AT(m, anf)) continue;
+	    V term = ~(c ^ c);
+	    if (m & 4) term &= l;
+	    if (m & 2) term &= c;
+	    if (m & 1) term &= r;
+	    next ^= term;
+	}
+	memcpy(out + i, &next, sizeof(V));
+    }
+    // the words left over by the vector loop
+    if constexpr (lanes > 1) {
+	if (i < words) elementary_row_kernel<u64>(in + i, out + i, words - i, anf);
+    }
+}
+
+template<bool CONWAY>
+static void life_row_scalar(const u64* above, const u64* center, const u64* below, u64* out, size_t words, const Life_Rule& rule) {
+    life_row_kernel<u64, CONWAY>(above, center, below, out, words, rule);
+}
+
+static void elementary_row_scalar(const u64* in, u64* out, size_t words, u8 anf) {
+    elementary_row_kernel<u64>(in, out, words, anf);
+}
+
+typedef u64 u64x2 __attribute__((vector_size(16)));
+typedef u64 u64x4 __attribute__((vector_size(32)));
+
+#ifdef LIFE_X86
+template<bool CONWAY> __attribute__((target("sse2")))
+static void life_row_sse2(const u64* above, const u64* center, const u64* below, u64* out, size_t words, const Life_Rule& rule) {
+    life_row_kernel<u64x2, CONWAY>(above, center, below, out, words, rule);
+}
+
+template<bool CONWAY> __attribute__((target("avx2")))
+static void life_row_avx2(const u64* above, const u64* center, const u64* below, u64* out, size_t words, const Life_Rule& rule) {
+    life_row_kernel<u64x4, CONWAY>(above, center, below, out, words, rule);
+}
+
+__attribute__((target("sse2")))
+static void elementary_row_sse2(const u64* in, u64* out, size_t words, u8 anf) {
+    elementary_row_kernel<u64x2>(in, out, words, anf);
+}
+
+__attribute__((target("avx2")))
+static void elementary_row_avx2(const u64* in, u64* out, size_t words, u8 anf) {
+    elementary_row_kernel<u64x4>(in, out, words, anf);
+}
+#endif
+
+#ifdef LIFE_NEON
+template<bool CONWAY>
+static void life_row_neon(const u64* above, const u64* center, const u64* below, u64* out, size_t words, const Life_Rule& rule) {
+    life_row_kernel<u64x2, CONWAY>(above, center, below, out, words, rule);
+}
+
+static void elementary_row_neon(const u64* in, u64* out, size_t words, u8 anf) {
+    elementary_row_kernel<u64x2>(in, out, words, anf);
+}
+#endif
+
+static bool simd_level_supported(Simd_Level level) {
+    switch (level) {
+	case SIMD_SCALAR:
+	    return true;
+#ifdef LIFE_X86
+	case SIMD_SSE2:
+	    return __builtin_cpu_supports("sse2");
+	case SIMD_AVX2:
+	    return __builtin_cpu_supports("avx2");
+#endif
+#ifdef LIFE_NEON
+	case SIMD_NEON:
+	    return true;
+#endif
+	default:
+	    return false;
+    }
+}
+
+// widest instruction set of the machine we are running on, checked once
+static Simd_Level best_simd_level() {
+    static Simd_Level best = [] {
+	Simd_Level level = SIMD_SCALAR;
+	for (int l = SIMD_SCALAR; l < SIMD_LEVEL_MAX; ++l) {
+	    if (simd_level_supported((Simd_Level)l)) level = (Simd_Level)l;
+	}
+	return level;
+    }();
+    return best;
+}
+
+// conway gets its own kernel, every other rule runs through the compiled circuit
+static Life_Row_Func life_row_func(Simd_Level level, const Life_Rule& rule) {
+    assert(simd_level_supported(level) && "instruction set not supported on this cpu");
+    bool conway = rule.is_conway();
+    switch (level) {
+#ifdef LIFE_X86
+	case SIMD_SSE2:
+	    return conway ? life_row_sse2<true> : life_row_sse2<false>;
+	case SIMD_AVX2:
+	    return conway ? life_row_avx2<true> : life_row_avx2<false>;
+#endif
+#ifdef LIFE_NEON
+	case SIMD_NEON:
+	    return conway ? life_row_neon<true> : life_row_neon<false>;
+#endif
+	default:
+	    return conway ? life_row_scalar<true> : life_row_scalar<false>;
+    }
+}
+
+static Elementary_Row_Func elementary_row_func(Simd_Level level) {
+    assert(simd_level_supported(level) && "instruction set not supported on this cpu");
+    switch (level) {
+#ifdef LIFE_X86
+	case SIMD_SSE2:
+	    return elementary_row_sse2;
+	case SIMD_AVX2:
+	    return elementary_row_avx2;
+#endif
+#ifdef LIFE_NEON
+	case SIMD_NEON:
+	    return elementary_row_neon;
+#endif
+	default:
+	    return elementary_row_scalar;
+    }
+}
@@ -0,0 +1,183 @@
+#pragma once
+#include <cctype>
+#include <string>
+#include <vector>
+#include "common.h"
+
+// inputs of the compiled rule circuit: the cell itself and the bits of its neighbour count
+enum Rule_Input {
+    RULE_ALIVE, RULE_ONES, RULE_TWOS, RULE_FOURS, RULE_EIGHTS, RULE_INPUT_MAX
+};
+
+// one product term of the circuit, the inputs in care have to equal the bits in value
+struct Rule_Term {
+    u8 care;
+    u8 value;
+};
+
+// a term as whole word masks for the kernels, (input ^ flip) | ignore is all ones where the
+// input matches the term, so a term is evaluated without a branch per input
+struct Rule_Term_Masks {
+    u64 flip[RULE_INPUT_MAX];
+    u64 ignore[RULE_INPUT_MAX];
+};
+
+// outer totalistic life-like rule, bit n of birth / survive is set if a cell with n
+// live neighbours is born / survives
+struct Life_Rule {
+    u16 birth = 1 << 3;
+    u16 survive = (1 << 2) | (1 << 3);
+    // sum of products over the Rule_Inputs, evaluated on whole words by the bit packed kernels
+    std::vector<Rule_Term> terms = compile(birth, survive);
+    std::vector<Rule_Term_Masks> term_masks = masks_of(terms);
+
+    bool operator==(const Life_Rule& other) const {
+	return birth == other.birth && survive == other.survive;
+    }
+
+    bool is_conway() const {
+	return birth == (1 << 3) && survive == ((1 << 2) | (1 << 3));
+    }
+
+    // B0 rules turn empty space alive, they need the whole plane in every generation
+    bool births_from_nothing() const {
+	return birth & 1;
+    }
+
+    bool next_state(bool alive, int neighbours) const {
+	return BIT_AT(neighbours, alive ? survive : birth);
+    }
+
+    // accepts "B36/S23", "S23/B36" and the old "23/36" survive/birth notation
+    bool parse(const char* text) {
+	u16 new_birth = 0;
+	u16 new_survive = 0;
+	u16* target = NULL;
+	bool named = false;
+	int slashes = 0;
+	for (const char* c = text; *c; ++c) {
+	    char l = tolower(*c);
+	    if (l == 'b') {
+		target = &new_birth;
+		named = true;
+	    }
+	    else if (l == 's') {
+		target = &new_survive;
+		named = true;
+	    }
+	    else if (l == '/') {
+		slashes++;
+		if (!named) target = slashes == 1 ? &new_birth : NULL;
+		else target = NULL;
+	    }
+	    else if (l >= '0' && l <= '8') {
+		if (!target && !named && slashes == 0) target = &new_survive;
+		if (!target) return false;
+		BIT_SET(l - '0', *target);
+	    }
+	    else if (!isspace(l)) {
+		return false;
+	    }
+	}
+	// an empty string is no rule, "B/S" is the one where nothing ever lives
+	if (!named && slashes == 0 && !new_survive) return false;
+	if (slashes > 1) return false;
+	set(new_birth, new_survive);
+	return true;
+    }
+
+    void set(u16 new_birth, u16 new_survive) {
+	birth = new_birth;
+	survive = new_survive;
+	terms = compile(birth, survive);
+	term_masks = masks_of(terms);
+    }
+
+    std::string to_string() const {
+	std::string text = "B";
+	for (int n = 0; n <= 8; ++n) if (BIT_AT(n, birth)) text += '0' + n;
+	text += "/S";
+	for (int n = 0; n <= 8; ++n) if (BIT_AT(n, survive)) text += '0' + n;
+	return text;
+    }
+
+    // minimizes the rule into prime implicants (quine-mccluskey) and covers it greedily.
+    // a set eights bit only happens with a count of exactly 8, every other combination with
+    // it is a don't care
+    static std::vector<Rule_Term> compile(u16 birth, u16 survive) {
+	const int inputs = RULE_INPUT_MAX;
+	const int combinations = 1 << inputs;
+	auto count_of = [](int m) {
+	    return (int)BIT_AT(RULE_ONES, m) + 2 * (int)BIT_AT(RULE_TWOS, m) + 4 * (int)BIT_AT(RULE_FOURS, m) + 8 * (int)BIT_AT(RULE_EIGHTS, m);
+	};
+	std::vector<bool> on(combinations, false);
+	std::vector<bool> dont_care(combinations, false);
+	for (int m = 0; m < combinations; ++m) {
+	    int count = count_of(m);
+	    if (count > 8) {
+		dont_care[m] = true;
+		continue;
+	    }
+	    on[m] = BIT_AT(count, BIT_AT(RULE_ALIVE, m) ? survive : birth);
+	}
+
+	// merge terms that differ in one input until nothing merges anymore
+	std::vector<Rule_Term> current;
+	for (int m = 0; m < combinations; ++m) {
+	    if (on[m] || dont_care[m]) current.push_back({(u8)(combinations - 1), (u8)m});
+	}
+	std::vector<Rule_Term> primes;
+	while (!current.empty()) {
+	    std::vector<Rule_Term> merged;
+	    std::vector<bool> used(current.size(), false);
+	    for (size_t i = 0; i < current.size(); ++i) {
+		for (size_t j = i + 1; j < current.size(); ++j) {
+		    if (current[i].care != current[j].care) continue;
+		    u8 diff = current[i].value ^ current[j].value;
+		    if (__builtin_popcount(diff) != 1) continue;
+		    used[i] = used[j] = true;
+		    Rule_Term term = {(u8)(current[i].care & ~diff), (u8)(current[i].value & ~diff)};
+		    bool duplicate = false;
+		    for (const Rule_Term& t : merged) duplicate |= t.care == term.care && t.value == term.value;
+		    if (!duplicate) merged.push_back(term);
+		}
+	    }
+	    for (size_t i = 0; i < current.size(); ++i) {
+		if (!used[i]) primes.push_back(current[i]);
+	    }
+	    current.swap(merged);
+	}
+
+	// pick the prime covering most of the still uncovered minterms until all are covered
+	auto covers = [](const Rule_Term& t, int m) { return (m & t.care) == t.value; };
+	std::vector<Rule_Term> terms;
+	std::vector<bool> covered(combinations, false);
+	while (true) {
+	    int best = -1;
+	    int best_count = 0;
+	    for (size_t p = 0; p < primes.size(); ++p) {
+		int count = 0;
+		for (int m = 0; m < combinations; ++m) count += on[m] && !covered[m] && covers(primes[p], m);
+		if (count > best_count) {
+		    best = p;
+		    best_count = count;
+		}
+	    }
+	    if (best < 0) break;
+	    terms.push_back(primes[best]);
+	    for (int m = 0; m < combinations; ++m) covered[m] = covered[m] || covers(primes[best], m);
+	}
+	return terms;
+    }
+
+    static std::vector<Rule_Term_Masks> masks_of(const std::vector<Rule_Term>& terms) {
+	std::vector<Rule_Term_Masks> masks(terms.size());
+	for (size_t t = 0; t < terms.size(); ++t) {
+	    for (int k = 0; k < RULE_INPUT_MAX; ++k) {
+		masks[t].flip[k] = BIT_AT(k, terms[t].value) ? 0 : ~u64(0);
+		masks[t].ignore[k] = BIT_AT(k, terms[t].care) ? 0 : ~u64(0);
+	    }
+	}
+	return masks;
+    }
+};
@@ -0,0 +1,106 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <vector>
+#include "common.h"
+#include "grid.h"
+
+// levels of detail of a width x height grid of states for viewing it zoomed out.
+// a sample of level k is the highest state (any alive for dead / alive states) of the
+// 2^k x 2^k cells it covers, level 0 are the cells themselves and are not stored.
+// update() only recomputes the blocks over dirty rows, so keeping it current costs as
+// much as the cells that changed
+template<typename T> class Lod_Pyramid {
+public:
+    size_t width = 0;
+    size_t height = 0;
+    // levels 1 and up, levels[k - 1] is level k
+    std::vector<std::vector<T>> levels;
+    std::vector<size_t> level_widths;
+    std::vector<size_t> level_heights;
+
+    void init(size_t width, size_t height) {
+	this->width = width;
+	this->height = height;
+	levels.clear();
+	level_widths.assign(1, width);
+	level_heights.assign(1, height);
+	size_t w = width;
+	size_t h = height;
+	while (w > 1 || h > 1) {
+	    w = (w + 1) / 2;
+	    h = (h + 1) / 2;
+	    level_widths.push_back(w);
+	    level_heights.push_back(h);
+	    levels.emplace_back(w * h);
+	}
+	initialized = false;
+    }
+
+    size_t level_count() const {
+	return level_widths.size();
+    }
+
+    T sample(const T* cells, size_t level, size_t x, size_t y) const {
+	if (level == 0) return cells[INDEX(x, y, width)];
+	return levels[level - 1][INDEX(x, y, level_widths[level])];
+    }
+
+    // the first update after init() rebuilds every level
+    void update(const T* cells, const Dirty_Rows& dirty) {
+	assert(dirty.height() == height);
+	span_begin.assign(dirty.begin.begin(), dirty.begin.end());
+	span_end.assign(dirty.end.begin(), dirty.end.end());
+	if (!initialized) {
+	    for (size_t y = 0; y < height; ++y) {
+		span_begin[y] = 0;
+		span_end[y] = width;
+	    }
+	    initialized = true;
+	}
+	for (size_t k = 1; k < level_count(); ++k) {
+	    size_t w = level_widths[k];
+	    size_t h = level_heights[k];
+	    size_t src_width = level_widths[k - 1];
+	    size_t src_height = level_heights[k - 1];
+	    const T* src = k == 1 ? cells : levels[k - 2].data();
+	    T* dst = levels[k - 1].data();
+	    for (size_t y = 0; y < h; ++y) {
+		// the block row is dirty if one of its two source rows is
+		size_t y0 = 2 * y;
+		size_t y1 = std::min(y0 + 1, src_height - 1);
+		u32 b = std::min(span_begin[y0], span_begin[y1]);
+		u32 e = std::max(span_end[y0], span_end[y1]);
+		if (span_begin[y0] >= span_end[y0]) {
+		    b = span_begin[y1];
+		    e = span_end[y1];
+		}
+		else if (span_begin[y1] >= span_end[y1]) {
+		    b = span_begin[y0];
+		    e = span_end[y0];
+		}
+		if (b >= e) {
+		    span_begin[y] = span_end[y] = 0;
+		    continue;
+		}
+		size_t x_begin = b / 2;
+		size_t x_end = std::min((size_t)(e + 1) / 2, w);
+		for (size_t x = x_begin; x < x_end; ++x) {
+		    size_t x0 = 2 * x;
+		    size_t x1 = std::min(x0 + 1, src_width - 1);
+		    T top = std::max(src[INDEX(x0, y0, src_width)], src[INDEX(x1, y0, src_width)]);
+		    T bottom = std::max(src[INDEX(x0, y1, src_width)], src[INDEX(x1, y1, src_width)]);
+		    dst[INDEX(x, y, w)] = std::max(top, bottom);
+		}
+		span_begin[y] = x_begin;
+		span_end[y] = x_end;
+	    }
+	}
+    }
+
+private:
+    bool initialized = false;
+    // dirty spans of the level being built from, rewritten in place for the next level
+    std::vector<u32> span_begin;
+    std::vector<u32> span_end;
+};
@@ -0,0 +1,254 @@
+#pragma once
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "common.h"
+#include "cell_automata.h"
+#include "hashlife.h"
+
+// golly's macrocell format, a quadtree where every distinct node is written once:
+//   [M2] (cell_automata)
+//   #R B3/S23
+//   #G 0
+//   .*$..*$***$        an 8x8 leaf, rows end with $, * is alive, trailing dead cells are left out
+//   4 1 0 0 1          a node of level 4 (16x16) and its nw ne sw se children,
+//                      numbered from 1 in file order, 0 is the empty node
+// the last node is the root, its center is the origin of the universe
+
+// reads the file line by line and builds the nodes through Hash_Life::node(), so equal
+// subtrees become one node while reading and a 2^30 wide universe costs as much as its
+// distinct nodes
+class Macrocell_Reader {
+public:
+    ~Macrocell_Reader() {
+	if (file) fclose(file);
+    }
+
+    // empty if the file has no #R line
+    std::string rule;
+    u64 generation = 0;
+
+    // the root of the universe, NULL if the file could not be read
+    Hash_Node* read(const char* path, Hash_Life& life) {
+	file = fopen(path, "rb");
+	if (!file) {
+	    std::cout << "macrocell: could not open " << path << "\n";
+	    return NULL;
+	}
+	std::string line;
+	if (!next_line(line) || line.compare(0, 4, "[M2]")) {
+	    std::cout << "macrocell: " << path << " does not start with [M2]\n";
+	    return NULL;
+	}
+	// index 0 is the empty node, its level depends on the parent
+	nodes.assign(1, NULL);
+	size_t number = 1;
+	while (next_line(line)) {
+	    number++;
+	    if (line.empty()) continue;
+	    if (line[0] == '#') {
+		if (line.compare(0, 2, "#R") == 0) rule = trim(line.substr(2));
+		else if (line.compare(0, 2, "#G") == 0) generation = strtoull(line.c_str() + 2, NULL, 10);
+		continue;
+	    }
+	    Hash_Node* n = line[0] == '.' || line[0] == '*' || line[0] == '$' ? leaf(line, life) : node(line, life);
+	    if (!n) {
+		std::cout << "macrocell: " << path << " line " << number << " is not a node: " << line << "\n";
+		return NULL;
+	    }
+	    nodes.push_back(n);
+	}
+	if (nodes.size() < 2) {
+	    std::cout << "macrocell: " << path << " has no nodes\n";
+	    return NULL;
+	}
+	return nodes.back();
+    }
+
+private:
+    FILE* file = NULL;
+    char buffer[1 << 16];
+    size_t length = 0;
+    size_t at = 0;
+    std::vector<Hash_Node*> nodes;
+
+    bool next_line(std::string& line) {
+	line.clear();
+	while (true) {
+	    if (at == length) {
+		length = fread(buffer, 1, sizeof(buffer), file);
+		at = 0;
+		if (length == 0) return !line.empty();
+	    }
+	    char c = buffer[at++];
+	    if (c == '\n') return true;
+	    if (c != '\r') line += c;
+	}
+    }
+
+    static std::string trim(const std::string& s) {
+	size_t begin = s.find_first_not_of(" \t");
+	size_t end = s.find_last_not_of(" \t");
+	return begin == std::string::npos ? "" : s.substr(begin, end - begin + 1);
+    }
+
+    // an 8x8 leaf, level 3
+    Hash_Node* leaf(const std::string& line, Hash_Life& life) {
+	bool cells[8][8] = {};
+	int x = 0;
+	int y = 0;
+	for (char c : line) {
+	    if (c == '$') {
+		x = 0;
+		y++;
+		continue;
+	    }
+	    if (x >= 8 || y >= 8 || (c != '.' && c != '*')) return NULL;
+	    cells[y][x++] = c == '*';
+	}
+	return build(life, cells, 3, 0, 0);
+    }
+
+    Hash_Node* build(Hash_Life& life, bool (&cells)[8][8], u32 level, int x, int y) {
+	if (level == 0) return life.leaf(cells[y][x]);
+	int h = 1 << (level - 1);
+	return life.node(build(life, cells, level - 1, x, y), build(life, cells, level - 1, x + h, y),
+			 build(life, cells, level - 1, x, y + h), build(life, cells, level - 1, x + h, y + h));
+    }
+
+    // "level nw ne sw se", children are earlier nodes one level down or 0
+    Hash_Node* node(const std::string& line, Hash_Life& life) {
+	unsigned long long level = 0;
+	unsigned long long children[4] = {};
+	if (sscanf(line.c_str(), "%llu %llu %llu %llu %llu", &level, &children[0], &children[1], &children[2], &children[3]) != 5) return NULL;
+	if (level < 4 || level > 62) return NULL;
+	Hash_Node* q[4];
+	for (int i = 0; i < 4; ++i) {
+	    if (children[i] >= nodes.size()) return NULL;
+	    q[i] = children[i] ? nodes[children[i]] : life.empty(level - 1);
+	    if (q[i]->level != level - 1) return NULL;
+	}
+	return life.node(q[0], q[1], q[2], q[3]);
+    }
+};
+
+// writes every distinct node once, children before their parents
+class Macrocell_Writer {
+public:
+    bool write(const char* path, Hash_Node* root, const std::string& rule, u64 generation) {
+	FILE* file = fopen(path, "w");
+	if (!file) {
+	    std::cout << "macrocell: could not open " << path << " for writing\n";
+	    return false;
+	}
+	this->file = file;
+	numbers.clear();
+	count = 0;
+	fprintf(file, "[M2] (cell_automata)\n");
+	if (!rule.empty()) fprintf(file, "#R %s\n", rule.c_str());
+	fprintf(file, "#G %llu\n", (unsigned long long)generation);
+	// golly expects at least one node, an empty universe is an empty leaf
+	if (root->population == 0) fprintf(file, "$\n");
+	else write_node(root);
+	return fclose(file) == 0;
+    }
+
+private:
+    FILE* file = NULL;
+    std::unordered_map<Hash_Node*, u64> numbers;
+    u64 count = 0;
+
+    // the number of n in the file, 0 for empty nodes
+    u64 write_node(Hash_Node* n) {
+	if (n->population == 0) return 0;
+	auto found = numbers.find(n);
+	if (found != numbers.end()) return found->second;
+	if (n->level == 3) {
+	    write_leaf(n);
+	}
+	else {
+	    u64 nw = write_node(n->nw);
+	    u64 ne = write_node(n->ne);
+	    u64 sw = write_node(n->sw);
+	    u64 se = write_node(n->se);
+	    fprintf(file, "%u %llu %llu %llu %llu\n", n->level, (unsigned long long)nw, (unsigned long long)ne,
+		    (unsigned long long)sw, (unsigned long long)se);
+	}
+	numbers[n] = ++count;
+	return count;
+    }
+
+    static bool alive(Hash_Node* n, int x, int y) {
+	for (int h = 1 << (n->level - 1); n->level > 0; h >>= 1) {
+	    if (y >= h) n = x >= h ? n->se : n->sw;
+	    else n = x >= h ? n->ne : n->nw;
+	    x &= h - 1;
+	    y &= h - 1;
+	}
+	return n->population != 0;
+    }
+
+    void write_leaf(Hash_Node* n) {
+	char line[8 * 9 + 2];
+	int length = 0;
+	// the row ends of empty rows before the last live row stay
+	int last_row = 0;
+	for (int y = 0; y < 8; ++y) {
+	    for (int x = 0; x < 8; ++x) if (alive(n, x, y)) last_row = y;
+	}
+	for (int y = 0; y <= last_row; ++y) {
+	    int last = -1;
+	    for (int x = 0; x < 8; ++x) if (alive(n, x, y)) last = x;
+	    for (int x = 0; x <= last; ++x) line[length++] = alive(n, x, y) ? '*' : '.';
+	    line[length++] = '$';
+	}
+	line[length++] = '\n';
+	fwrite(line, 1, length, file);
+    }
+};
+
+// loads a universe into the automat. with the hashlife engine the whole universe becomes its
+// state and the cells are the window around the origin, other engines only get the window.
+// restart() goes back to the window, not to the universe
+template<typename T> bool load_macrocell(Cell_Automat<T>& automat, const char* path) {
+    assert(automat.type == TWO_DIM && "macrocell files are 2D");
+    Hash_Life scratch;
+    Hash_Life& life = automat.engine == HASHLIFE_ENGINE ? automat.hashlife : scratch;
+    Macrocell_Reader reader;
+    Hash_Node* root = reader.read(path, life);
+    if (!root) return false;
+    // reloads the engine, the nodes that were read stay until the next step
+    if (!reader.rule.empty() && !automat.set_ruleset(reader.rule == "Life" ? "B3/S23" : reader.rule.c_str())) {
+	std::cout << "macrocell: keeping the rule " << automat.life_rule.to_string() << "\n";
+    }
+    life.set_root(root, reader.generation);
+    automat.generation = reader.generation;
+    if (automat.uses_hashlife()) {
+	automat.cells_stale = true;
+	automat.dirty.mark_all();
+	memcpy(automat.initial_cells, automat.sync_cells(), sizeof(T) * automat.size);
+	return true;
+    }
+    // a B0 rule falls back to the reference engine
+    std::vector<T> cells(automat.size);
+    life.store(cells.data(), automat.width, automat.height, automat.zero, automat.one);
+    automat.set_cells(cells.data());
+    return true;
+}
+
+// the whole universe of the hashlife engine, or the cells of the other engines
+template<typename T> bool save_macrocell(Cell_Automat<T>& automat, const char* path) {
+    assert(automat.type == TWO_DIM && "macrocell files are 2D");
+    Macrocell_Writer writer;
+    if (automat.uses_hashlife()) {
+	return writer.write(path, automat.hashlife.root, automat.life_rule.to_string(), automat.generation);
+    }
+    Hash_Life scratch;
+    scratch.load(automat.sync_cells(), automat.width, automat.height, automat.one);
+    return writer.write(path, scratch.root, automat.life_rule.to_string(), automat.generation);
+}
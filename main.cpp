@@ -1,12 +1,20 @@
 #include "raygui.h"
 #include "raylib/src/raylib.h"
 #include "cell_automata.h"
+#include "sim_thread.h"
+#include "palette.h"
+#include "rle.h"
+#include "macrocell.h"
+#include "snapshot.h"
+#include <algorithm>
 #include <cinttypes>
 #include <cmath>
 #include <cstring>
+#include <ctime>
 #include <iostream>
 #include <cassert>
 #include <string>
+#include <vector>
 #include "gui.h"
 
 typedef uint32_t u32;
@@ -20,8 +28,12 @@ state state = VIEW_CURRENT;
 bool mouse_draw = true;
 bool debugging = false;
 
+// the automats store states, colors only exist in the palette
+const u8 dead_state = 0;
+const u8 alive_state = 1;
 u32 alive_col = 0xFFFF1111;
 u32 dead_col  = 0xFF181818;
+Palette palette;
 
 KeyboardKey autoplay_key = KEY_SPACE;
 KeyboardKey next_frame_key = KEY_RIGHT;
@@ -38,32 +50,82 @@ float window_height = 900;
 
 float min_dim = std::min(window_width, window_height);
 Rectangle view_area = {0, 0, min_dim, min_dim};
-float cell_width = view_area.width / (float)cell_cols;
-float cell_height = view_area.height / (float)cell_rows;
 Rectangle control_area = {view_area.width, 0, window_width - view_area.width, window_height};
-int controls_num_widgets = 10;
+int controls_num_widgets = 16;
 Layout control_layout = Layout(control_area, VERTICAL, controls_num_widgets, 5);
 int control_index = 0;
 bool automat_type_selection = 0;
+int engine_selection = REFERENCE_ENGINE;
+int boundary_selection = BOUNDARY_TORUS;
 
 bool autoplay = false;
-double seconds_passed = 0.f;
-float max_fps = 100.f;
-float target_fps = 60;
-
-Cell_Automat<u32>* active_automat;
-Cell_Automat<u32>* next_automat;
+// the gui frame rate, the simulation runs at its own rate on the sim thread
+float max_fps = 60.f;
+float max_gens_per_second = 10000.f;
+float target_gens_per_second = 60;
+int pace_selection = PACE_RATE;
+float gens_per_frame = 1;
+float max_gens_per_frame = 1000;
+float random_density_selection = 0.5f;
+// seconds the sim steps for between two frames at max pace
+float step_budget = 0.008f;
+float hashlife_step_log = 0;
+
+Thread_Pool pool;
+float thread_count = pool.threads();
+// the pool is resized on the sim thread, the gui only compares with what it asked for last
+size_t requested_threads = pool.threads();
+float max_threads = std::thread::hardware_concurrency();
+
+Cell_Automat<u8>* active_automat;
+Cell_Automat<u8>* next_automat;
 float next_cell_cols = 0;
 float next_cell_rows = 0;
 u64 next_one_dim_ruleset = 0;
-u32* next_input = NULL;
-Cell_Automat<u32>* prev_automat;
+// life-like rulestring of the next two dimensional automat
+char next_life_rule[32] = "B3/S23";
+bool next_life_rule_edit = false;
+u8* next_input = NULL;
+Cell_Automat<u8>* prev_automat;
+
+// the gui never touches the automats directly, edits go through the command queue
+// and what is drawn is the last generation the sim thread published
+Sim_Thread<u8> sim;
+const Sim_Frame<u8>* frame = &sim.frames.front();
+
+// rows that scroll out of an unbounded 1D automat, only touched on the sim thread
+Row_Log spill_log;
+const char* spill_path = "history.ca1d";
+// patterns are saved here and loaded by dropping a file on the window,
+// 2D automats are also saved as a macrocell
+const char* pattern_path = "pattern.rle";
+const char* macrocell_path = "pattern.mc";
+// binary checkpoint of the whole state, written in the background while the automat keeps running
+Checkpoint_Writer checkpoint;
+const char* checkpoint_path = "checkpoint.casnap";
+// recorded generations over the recorder's memory limit go here
+const char* recording_spill_path = "recording.carec";
+// generation the replay slider was dragged to, it follows the frames again once released
+float replay_generation = 0.f;
+bool scrubbing = false;
 
 Texture txt;
-
-Rectangle brush_view_rec = {0.f, 0.f, 1.f, 1.f};
-float brush_width = 1.f;
-float brush_height = 1.f;
+// the colorized frame, the texture stays RGBA so drawing needs no shader
+std::vector<u32> pixels;
+u64 uploaded_palette = 0;
+// colorized pixels of one dirty rectangle
+std::vector<u32> rect_pixels;
+
+// the camera: the world cell at the top left corner of the view area and screen pixels per cell.
+// zoomed out below a pixel per cell the sim thread sends downsampled frames
+Vector2 camera = {0.f, 0.f};
+float zoom = 1.f;
+float max_zoom = 64.f;
+KeyboardKey fit_view_key = KEY_F;
+// world the camera was fitted to, a new size fits it again
+size_t camera_world_width = 0;
+size_t camera_world_height = 0;
+Sim_View sent_view;
 
 
 void resize() {
@@ -77,16 +139,64 @@ void resize() {
 		    .width = vertical ? window_width : window_width - view_area.width, 
 		    .height = vertical ? window_height - view_area.height : window_height};
     control_layout = Layout(control_area, VERTICAL, controls_num_widgets, 5);
-    cell_width = view_area.width / (float)cell_cols;
-    cell_height = view_area.height / (float)cell_rows;
-    brush_view_rec.width = cell_width * brush_width;
-    brush_view_rec.height = cell_height * brush_height;
     control_layout.set_spacing(min_dim / 30.f);
 }
 
-void set_active(Cell_Automat<u32>* active) {
+bool frame_initialized() {
+    return frame->type != AUTOMATA_TYPE_MAX;
+}
+
+void fit_view() {
+    camera_world_width = frame->width;
+    camera_world_height = frame->height;
+    zoom = std::min(view_area.width / frame->width, view_area.height / frame->height);
+    camera.x = (frame->width - view_area.width / zoom) / 2.f;
+    camera.y = (frame->height - view_area.height / zoom) / 2.f;
+}
+
+Vector2 screen_to_world(Vector2 p) {
+    return {camera.x + (p.x - view_area.x) / zoom, camera.y + (p.y - view_area.y) / zoom};
+}
+
+// wheel zooms around the cursor, the right button drags the world around
+void update_camera() {
+    if (!frame_initialized()) return;
+    if (frame->width != camera_world_width || frame->height != camera_world_height || IsKeyPressed(fit_view_key)) {
+	fit_view();
+    }
+    Vector2 mouse_pos = GetMousePosition();
+    if (CheckCollisionPointRec(mouse_pos, view_area)) {
+	float wheel = GetMouseWheelMove();
+	if (wheel != 0.f) {
+	    Vector2 anchor = screen_to_world(mouse_pos);
+	    float min_zoom = std::min(view_area.width / frame->width, view_area.height / frame->height) / 2.f;
+	    zoom = std::clamp(zoom * powf(1.25f, wheel), min_zoom, max_zoom);
+	    camera.x = anchor.x - (mouse_pos.x - view_area.x) / zoom;
+	    camera.y = anchor.y - (mouse_pos.y - view_area.y) / zoom;
+	}
+	if (IsMouseButtonDown(MOUSE_BUTTON_RIGHT)) {
+	    Vector2 delta = GetMouseDelta();
+	    camera.x -= delta.x / zoom;
+	    camera.y -= delta.y / zoom;
+	}
+    }
+    // a sample covers 2^level cells, about one pixel or more
+    Sim_View view;
+    view.x0 = floor(camera.x);
+    view.y0 = floor(camera.y);
+    view.x1 = ceil(camera.x + view_area.width / zoom);
+    view.y1 = ceil(camera.y + view_area.height / zoom);
+    view.level = zoom < 1.f ? (int)floor(log2(1.f / zoom)) : 0;
+    if (!(view == sent_view)) {
+	sim.set_view(view);
+	sent_view = view;
+    }
+}
+
+void set_active(Cell_Automat<u8>* active) {
     prev_automat = active_automat;
     active_automat = active;
+    sim.set_automat(active);
 }
 
 void switch_to_next() {
@@ -107,32 +217,35 @@ Rectangle get_next_control_slot(bool spaced = true) {
 }
 
 void control_current_automat() {
-    if (autoplay || IsKeyReleased(next_frame_key)) {
-	if (seconds_passed >= 1.f / target_fps) { 
-	    seconds_passed = 0.f;
-	    active_automat->apply_rules(); 
-	}
+    if (IsKeyReleased(next_frame_key)) {
+	sim.request_step();
     }
     // info about current layout
-    std::string table_body = active_automat->type == ONE_DIM ? "1D elementary" : "2D Game of life"; table_body += '\0';
-    table_body += std::to_string(active_automat->width); table_body += '\0';
-    table_body += std::to_string(active_automat->height); table_body += '\0';
-    Gui::table(get_next_control_slot(), 3, 1, "Type\0Width\0Height", table_body.c_str());; 
+    std::string table_body = frame->type == ONE_DIM ? "1D elementary" : "2D Life-like"; table_body += '\0';
+    table_body += std::to_string(frame->width); table_body += '\0';
+    table_body += std::to_string(frame->height); table_body += '\0';
+    table_body += frame->uses_hashlife ? "none" : boundary_names[frame->boundary]; table_body += '\0';
+    table_body += std::to_string(frame->generation); table_body += '\0';
+    // the same hash as the headless runner prints, to check runs against each other
+    char hash_str[17];
+    snprintf(hash_str, sizeof(hash_str), "%016" PRIx64, frame->hash);
+    table_body += hash_str; table_body += '\0';
+    Gui::table(get_next_control_slot(), 6, 1, "Type\0Width\0Height\0Boundary\0Generation\0Hash", table_body.c_str());; 
     
 
     Layout ruleset_info_layout = Layout(get_next_control_slot(), SLICE_VERT, 0.1f, 1.f);
     Layout ruleset_label_layout = Layout(ruleset_info_layout.get_slot(0), HORIZONTAL, 2, 1.f);
     GuiDrawText("Ruleset:", ruleset_label_layout.get_slot(0, true), TEXT_ALIGN_LEFT, WHITE);
-    std::string ruleset_str = active_automat->type == TWO_DIM ? "Conway's game of life" : std::to_string(active_automat->one_dim_rules);
+    std::string ruleset_str = frame->type == TWO_DIM ? frame->life_rule : std::to_string(frame->one_dim_rules);
     GuiDrawText(ruleset_str.c_str(), ruleset_label_layout.get_slot(1, true), TEXT_ALIGN_LEFT, WHITE);
     // input one dimensional rules as binary
-    if (active_automat->type == ONE_DIM) {
+    if (frame->type == ONE_DIM) {
 	bool secret_view = true;
 	Layout ruleset_layout = Layout(ruleset_info_layout.get_slot(1), HORIZONTAL, 8, 5.f);
 	for(int i = 0; i < 8; ++i) {
 	    std::string binary = "000";
 	    Layout vert_layout = Layout(ruleset_layout.get_slot(i), VERTICAL, 2);
-	    int bit = BIT_AT(7 - i, active_automat->one_dim_rules);
+	    int bit = BIT_AT(7 - i, frame->one_dim_rules);
 	    std::string bit_str; 
 	    bit_str += '0' + bit;
 	    for (int j = 0; j < 3; ++j) {
@@ -141,16 +254,78 @@ void control_current_automat() {
 	    binary += "\nflip";
 	    GuiDrawText(bit_str.c_str(), vert_layout.get_slot(0), TEXT_ALIGN_MIDDLE, WHITE);
 	    if (GuiButton(vert_layout.get_slot(1), binary.c_str())) {
-		if (bit) {
-		    BIT_RESET(7 - i, active_automat->one_dim_rules);
-		}
-		else {
-		    BIT_SET(7 - i, active_automat->one_dim_rules);
-		}
+		sim.submit([i, bit](Cell_Automat<u8>& automat) {
+		    if (bit) {
+			BIT_RESET(7 - i, automat.one_dim_rules);
+		    }
+		    else {
+			BIT_SET(7 - i, automat.one_dim_rules);
+		    }
+		});
+	    }
+	}
+    }
+    // how the sim is paced and how fast it really is
+    Layout pace_layout = Layout(get_next_control_slot(), HORIZONTAL, 2, 5.f);
+    GuiComboBox(pace_layout.get_slot(0), "Pace: gens/s;Pace: gens/frame;Pace: max", &pace_selection);
+    std::string achieved_str = std::to_string((int)sim.achieved_rate) + " gens/s";
+    GuiDrawText(achieved_str.c_str(), pace_layout.get_slot(1, true), TEXT_ALIGN_LEFT, WHITE);
+    sim.pace = (Sim_Pace)pace_selection;
+    if (pace_selection == PACE_RATE) {
+	std::string rate_str = std::to_string((int)target_gens_per_second) + " gens/s";
+	GuiSlider(get_next_control_slot(), "0", rate_str.c_str(), &target_gens_per_second, 0.f, max_gens_per_second);
+	sim.target_rate = target_gens_per_second;
+    }
+    else if (pace_selection == PACE_PER_FRAME) {
+	std::string per_frame_str = std::to_string((int)gens_per_frame) + " gens/frame";
+	GuiSlider(get_next_control_slot(), "1", per_frame_str.c_str(), &gens_per_frame, 1.f, max_gens_per_frame);
+	gens_per_frame = round(gens_per_frame);
+	sim.gens_per_frame = gens_per_frame;
+    }
+    else {
+	std::string budget_str = std::to_string((int)(step_budget * 1000.f)) + " ms/frame";
+	GuiSlider(get_next_control_slot(), "1 ms", budget_str.c_str(), &step_budget, 0.001f, 1.f / max_fps);
+	sim.step_budget = step_budget;
+    }
+    if (frame->uses_hashlife) {
+	// generations per step as a power of two
+	std::string step_str = "2^" + std::to_string((int)hashlife_step_log) + " gens";
+	float step_log_prev = hashlife_step_log;
+	GuiSlider(get_next_control_slot(), "1 gen", step_str.c_str(), &hashlife_step_log, 0.f, 40.f);
+	hashlife_step_log = round(hashlife_step_log);
+	if (hashlife_step_log != step_log_prev) {
+	    int step_log = hashlife_step_log;
+	    sim.submit([step_log](Cell_Automat<u8>& automat) { automat.hashlife.set_step_log(step_log); });
+	}
+    }
+    else if (frame->uses_bits) {
+	std::string tiles_str = "Active tiles: " + std::to_string(frame->tiles_computed) + " / " + std::to_string(frame->tiles_total);
+	GuiDrawText(tiles_str.c_str(), get_next_control_slot(), TEXT_ALIGN_LEFT, WHITE);
+    }
+    else if (frame->type == ONE_DIM) {
+	// unbounded history, older rows can be spilled to disk
+	Layout stream_layout = Layout(get_next_control_slot(), HORIZONTAL, 2, 5.f);
+	bool streaming = frame->streaming;
+	GuiToggle(stream_layout.get_slot(0), "Unbounded", &streaming);
+	if (streaming != frame->streaming) {
+	    sim.submit([streaming](Cell_Automat<u8>& automat) { automat.set_streaming(streaming); });
+	}
+	if (frame->streaming) {
+	    bool spilling = frame->spilling;
+	    std::string spill_str = "Spill to " + std::string(spill_path);
+	    if (frame->spilling) spill_str = std::to_string(frame->spilled_rows) + " rows, " + std::to_string(frame->spilled_bytes / 1024) + " KiB";
+	    Rectangle spill_rec = stream_layout.get_slot(1);
+	    spill_rec.width = spill_rec.height;
+	    GuiCheckBox(spill_rec, spill_str.c_str(), &spilling);
+	    if (spilling != frame->spilling) {
+		sim.submit([spilling](Cell_Automat<u8>& automat) {
+		    automat.spill = NULL;
+		    spill_log.close();
+		    if (spilling && spill_log.open_write(spill_path, automat.width)) automat.spill = &spill_log;
+		});
 	    }
 	}
     }
-    GuiSlider(get_next_control_slot(), "0", std::to_string(max_fps).c_str(), &target_fps, 0.f, max_fps);
 
     bool autoplay_prev = autoplay;
     GuiToggle(get_next_control_slot(), "Play", &autoplay);
@@ -158,54 +333,128 @@ void control_current_automat() {
 	autoplay = !autoplay;
     }
     if (autoplay_prev != autoplay) {
-	// one dimensional automat reached max height
-	if (active_automat->type == ONE_DIM && active_automat->generation == active_automat->height - 1) {
-	    active_automat->generation = 0;
-	}
+	sim.submit([](Cell_Automat<u8>& automat) {
+	    // one dimensional automat reached max height
+	    if (automat.type == ONE_DIM && !automat.streaming && automat.generation >= automat.height - 1) {
+		automat.generation = 0;
+	    }
+	});
     }
+    sim.playing = autoplay;
 
-    if (GuiButton(get_next_control_slot(), "Restart")) {
-	active_automat->generation = 0;
-	memcpy(active_automat->cells, active_automat->initial_cells, active_automat->size);
+    Layout restart_layout = Layout(get_next_control_slot(), HORIZONTAL, 3, 5.f);
+    if (GuiButton(restart_layout.get_slot(0), "Restart")) {
+	sim.submit([](Cell_Automat<u8>& automat) { automat.restart(); });
 	//autoplay = false;
     }
+    if (GuiButton(restart_layout.get_slot(1), checkpoint.writing() ? "Checkpoint (writing)" : "Checkpoint")) {
+	sim.submit([](Cell_Automat<u8>& automat) {
+	    if (!checkpoint.start(automat, checkpoint_path)) std::cout << "the last checkpoint is still being written\n";
+	});
+    }
+    if (GuiButton(restart_layout.get_slot(2), "Restore")) {
+	sim.submit([](Cell_Automat<u8>& automat) {
+	    checkpoint.wait();
+	    load_snapshot(automat, checkpoint_path);
+	});
+    }
+
+    // every generation is recorded while on, the slider seeks back to any of them
+    Layout record_layout = Layout(get_next_control_slot(), HORIZONTAL, 2, 5.f);
+    bool recording = sim.recording;
+    GuiToggle(record_layout.get_slot(0), "Record", &recording);
+    if (recording != sim.recording) {
+	sim.recording = recording;
+	sim.submit([recording](Cell_Automat<u8>& automat) {
+	    sim.recorder.clear();
+	    sim.recorder.set_spill_path(recording ? recording_spill_path : NULL);
+	    if (recording) sim.recorder.record(automat);
+	});
+    }
+    if (!IsMouseButtonDown(MOUSE_BUTTON_LEFT)) scrubbing = false;
+    if (frame->recording && frame->recorded_last > frame->recorded_first) {
+	float replay = scrubbing ? replay_generation : (float)frame->generation;
+	float replay_prev = replay;
+	std::string first_str = std::to_string(frame->recorded_first);
+	std::string replay_str = std::to_string((u64)replay) + " / " + std::to_string(frame->recorded_last) +
+	    " (" + std::to_string(frame->recorded_bytes / 1024) + " KiB)";
+	GuiSlider(record_layout.get_slot(1), first_str.c_str(), replay_str.c_str(), &replay, frame->recorded_first, frame->recorded_last);
+	if (round(replay) != round(replay_prev)) {
+	    scrubbing = true;
+	    replay_generation = round(replay);
+	    autoplay = false;
+	    sim.playing = false;
+	    u64 generation = replay_generation;
+	    sim.submit([generation](Cell_Automat<u8>& automat) { sim.recorder.seek(automat, generation); });
+	}
+    }
 }
 
 void control_next_automat() {
     GuiToggle(get_next_control_slot(), automat_type_selection ? "Type: 2D" : "Type: 1D", &automat_type_selection);
 
+    GuiComboBox(get_next_control_slot(), "Engine: reference;Engine: bit packed;Engine: hashlife (2D)", &engine_selection);
+
+    GuiComboBox(get_next_control_slot(), "Boundary: torus;Boundary: dead;Boundary: mirror", &boundary_selection);
+
+    // rulestring of the 2D automat, B3/S23 is conway's game of life
+    if (GuiTextBox(get_next_control_slot(), next_life_rule, sizeof(next_life_rule), next_life_rule_edit)) {
+	next_life_rule_edit = !next_life_rule_edit;
+    }
+
     GuiSlider(get_next_control_slot(), std::to_string(min_cols).c_str(), std::to_string(max_cols).c_str(), &next_cell_cols, min_cols, max_cols);
     GuiSlider(get_next_control_slot(), std::to_string(min_rows).c_str(), std::to_string(max_rows).c_str(), &next_cell_rows, min_rows, max_rows);
     next_cell_cols = round(next_cell_cols);
     next_cell_rows = round(next_cell_rows);
 
-    if (GuiButton(get_next_control_slot(), "Apply\n(empties buffer)")) {
-	active_automat->init((Automata_Type)automat_type_selection, next_cell_cols, next_cell_rows, dead_col, alive_col);
-	std::cout << "Apply: after reiniting the automat\n";
+    std::string threads_str = std::to_string((int)thread_count) + " threads";
+    GuiSlider(get_next_control_slot(), "1", threads_str.c_str(), &thread_count, 1.f, max_threads);
+    thread_count = round(thread_count);
+    if ((size_t)thread_count != requested_threads) {
+	// the pool is only used from the sim thread, so it is resized there
+	size_t threads = thread_count;
+	requested_threads = threads;
+	sim.submit([threads](Cell_Automat<u8>&) { pool.set_threads(threads); });
+    }
 
-	UnloadTexture(txt);
-	Image h = GenImageColor(next_cell_cols, next_cell_rows, *(Color*)&dead_col);
-	txt = LoadTextureFromImage(h);
-	UnloadImage(h);
+    if (GuiButton(get_next_control_slot(), "Apply\n(empties buffer)")) {
+	Automata_Type type = (Automata_Type)automat_type_selection;
+	Engine engine = (Engine)engine_selection;
+	Boundary boundary = (Boundary)boundary_selection;
+	size_t cols = next_cell_cols;
+	size_t rows = next_cell_rows;
+	std::string life_rule = next_life_rule;
+	sim.submit([type, engine, boundary, cols, rows, life_rule](Cell_Automat<u8>& automat) {
+	    automat.init(type, cols, rows, dead_state, alive_state);
+	    automat.set_engine(engine);
+	    if (!automat.set_boundary(boundary)) {
+		std::cout << "hashlife has no boundary, the " << boundary_names[boundary] << " boundary is ignored\n";
+	    }
+	    std::cout << "Apply: after reiniting the automat\n";
 
-	if (automat_type_selection == TWO_DIM) {
-	    active_automat->set_rules_gol();
-	    std::cout << "Apply: after setting rules to game of life\n";
-	}
-	else {
-	    active_automat->set_ruleset_dec(next_one_dim_ruleset);
-	    std::cout << "Apply: after setting rules to next_one_dim_ruleset\n";
-	}
-	if (next_input) {
-	    active_automat->set_cells(next_input);
-	    std::cout << "Apply: after setting input\n";
-	}
-	std::cout << "Apply: after apply\n";
-	assert(active_automat->is_initialized());
-	assert(active_automat->rules && "rules not set on the new automat");
+	    if (type == TWO_DIM) {
+		automat.set_rules_gol();
+		if (!automat.set_ruleset(life_rule.c_str())) {
+		    std::cout << "invalid ruleset \"" << life_rule << "\", expected something like B3/S23\n";
+		}
+		if (automat.hashlife_fallback()) std::cout << "hashlife can not run B0 rules, using the reference rules\n";
+		std::cout << "Apply: after setting the life-like rules\n";
+	    }
+	    else {
+		automat.set_ruleset_dec(next_one_dim_ruleset);
+		std::cout << "Apply: after setting rules to next_one_dim_ruleset\n";
+	    }
+	    if (next_input) {
+		automat.set_cells(next_input);
+		std::cout << "Apply: after setting input\n";
+	    }
+	    std::cout << "Apply: after apply\n";
+	    assert(automat.is_initialized());
+	    assert(automat.rules && "rules not set on the new automat");
+	});
     }
 
-    if (active_automat->is_initialized()) {
+    if (frame_initialized()) {
 	if (GuiButton(get_next_control_slot(), "Start with current buffer")) {
 	    state = VIEW_CURRENT;
 	}
@@ -217,13 +466,13 @@ void control_window_selection() {
     if (GuiButton(top_row_layout.get_slot(0, true), "Edit current automat")) {
 	if (state != VIEW_CURRENT) {
 	    switch_back_to_current();
-	    active_automat->print();
+	    sim.submit([](Cell_Automat<u8>& automat) { automat.print(); });
 	}
     }
     if (GuiButton(top_row_layout.get_slot(1, true), "Prepare next automat")) {
 	if (state != PREPARE_NEXT) {
 	    switch_to_next();
-	    active_automat->print();
+	    sim.submit([](Cell_Automat<u8>& automat) { automat.print(); });
 	}
     }
     //top_row_layout.draw();
@@ -241,75 +490,177 @@ void controls() {
     }
 
 
-    if (GuiButton(get_next_control_slot(), "randomize buffer")) {
-	active_automat->randomize_cells();
+    Layout randomize_layout = Layout(get_next_control_slot(), HORIZONTAL, 2, 5.f);
+    if (GuiButton(randomize_layout.get_slot(0), "randomize buffer")) {
+	double density = random_density_selection;
+	sim.submit([density](Cell_Automat<u8>& automat) { automat.randomize_cells(density); });
     }
+    std::string density_str = std::to_string((int)round(random_density_selection * 100.f)) + "% alive";
+    GuiSlider(randomize_layout.get_slot(1), "0%", density_str.c_str(), &random_density_selection, 0.f, 1.f);
     if (GuiButton(get_next_control_slot(), "erase buffer")) {
-	active_automat->clear_cells();
+	sim.submit([](Cell_Automat<u8>& automat) { automat.clear_cells(); });
+    }
+    std::string save_str = "save " + std::string(pattern_path) + "\n(drop a .rle, .mc or .casnap to load)";
+    if (GuiButton(get_next_control_slot(), save_str.c_str())) {
+	sim.submit([](Cell_Automat<u8>& automat) {
+	    save_rle(automat, pattern_path);
+	    if (automat.type == TWO_DIM) save_macrocell(automat, macrocell_path);
+	});
     }
 
     Rectangle mouse_checkbox_rec = get_next_control_slot();
     mouse_checkbox_rec.width /= 5.f;
     GuiCheckBox(mouse_checkbox_rec, "Mouse drawing", &mouse_draw);
-    if (mouse_draw && active_automat->is_initialized()) {
+    if (mouse_draw && frame_initialized()) {
 	Vector2 mouse_pos = GetMousePosition();
-	if (CheckCollisionPointRec(mouse_pos, view_area)) {
-	    brush_view_rec.x = floor(mouse_pos.x - cell_width / 2.f); 
-	    brush_view_rec.y = floor(mouse_pos.y - cell_height / 2.f);
+	Vector2 cell = screen_to_world(mouse_pos);
+	cell = {floorf(cell.x), floorf(cell.y)};
+	bool in_world = cell.x >= 0.f && cell.y >= 0.f && cell.x < frame->width && cell.y < frame->height;
+	if (CheckCollisionPointRec(mouse_pos, view_area) && in_world) {
+	    Rectangle brush_view_rec = {view_area.x + (cell.x - camera.x) * zoom, view_area.y + (cell.y - camera.y) * zoom, zoom, zoom};
 	    if (IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
-		
-		Vector2 mouse_pos_projected = {mouse_pos.x / view_area.width * active_automat->width, mouse_pos.y / view_area.height * active_automat->height};
-		active_automat->cells[INDEX((int)mouse_pos_projected.x, (int)mouse_pos_projected.y, active_automat->width)] = active_automat->one;
+		size_t x = cell.x;
+		// the rows of an unbounded 1D automat are drawn starting at the oldest one
+		size_t y = ((size_t)cell.y + frame->first_row) % frame->height;
+		sim.submit([x, y](Cell_Automat<u8>& automat) {
+		    // the automat may have been resized since the frame was drawn
+		    if (x < automat.width && y < automat.height) automat.set_cell(x, y, automat.one);
+		});
 	    }
-	    DrawRectangleLinesEx(brush_view_rec, 2.f, WHITE);
+	    DrawRectangleLinesEx(brush_view_rec, std::min(2.f, zoom / 4.f + 1.f), WHITE);
+	}
+    }
+}
+
+// colorizes and uploads what changed in the newest generation the sim thread published,
+// or everything again after the palette changed. nothing is uploaded while paused.
+// the texture only holds the samples of the view window
+void update_view_texture() {
+    bool fresh = sim.frames.acquire();
+    frame = &sim.frames.front();
+    bool recolor = palette.version != uploaded_palette;
+    if ((!fresh && !recolor) || !frame_initialized()) return;
+    bool reload = recolor;
+    if (frame->view_width == 0 || frame->view_height == 0) return;
+    if (frame->view_width != (size_t)txt.width || frame->view_height != (size_t)txt.height) {
+	UnloadTexture(txt);
+	Image h = GenImageColor(frame->view_width, frame->view_height, COLOR_FROM_U32(dead_col));
+	txt = LoadTextureFromImage(h);
+	// the ring of a 1D automat is drawn wrapping around from its oldest row
+	SetTextureWrap(txt, TEXTURE_WRAP_REPEAT);
+	UnloadImage(h);
+	reload = true;
+    }
+    uploaded_palette = palette.version;
+    if (reload) {
+	pixels.resize(frame->view_width * frame->view_height);
+	colorize(frame->cells.data(), pixels.data(), pixels.size(), palette);
+	UpdateTexture(txt, pixels.data());
+	return;
+    }
+    // neighbouring dirty rows are merged into one rectangle spanning all of their columns
+    const Dirty_Rows& dirty = frame->dirty;
+    size_t y = 0;
+    while (y < frame->view_height) {
+	if (!dirty.is_dirty(y)) {
+	    y++;
+	    continue;
+	}
+	size_t y0 = y;
+	size_t x0 = dirty.begin[y];
+	size_t x1 = dirty.end[y];
+	for (; y < frame->view_height && dirty.is_dirty(y); ++y) {
+	    x0 = std::min(x0, (size_t)dirty.begin[y]);
+	    x1 = std::max(x1, (size_t)dirty.end[y]);
+	}
+	size_t rect_width = x1 - x0;
+	rect_pixels.resize(rect_width * (y - y0));
+	for (size_t r = y0; r < y; ++r) {
+	    colorize(frame->cells.data() + INDEX(x0, r, frame->view_width), rect_pixels.data() + (r - y0) * rect_width, rect_width, palette);
 	}
+	Rectangle rec = {(float)x0, (float)y0, (float)rect_width, (float)(y - y0)};
+	UpdateTextureRec(txt, rec, rect_pixels.data());
     }
 }
 
+void load_dropped_patterns() {
+    if (!IsFileDropped()) return;
+    FilePathList files = LoadDroppedFiles();
+    for (unsigned int i = 0; i < files.count; ++i) {
+	std::string path = files.paths[i];
+	if (IsFileExtension(files.paths[i], ".rle")) {
+	    sim.submit([path](Cell_Automat<u8>& automat) { load_rle(automat, path.c_str()); });
+	}
+	else if (IsFileExtension(files.paths[i], ".mc")) {
+	    sim.submit([path](Cell_Automat<u8>& automat) {
+		if (automat.type == TWO_DIM) load_macrocell(automat, path.c_str());
+	    });
+	}
+	else if (IsFileExtension(files.paths[i], ".casnap")) {
+	    sim.submit([path](Cell_Automat<u8>& automat) { load_snapshot(automat, path.c_str()); });
+	}
+    }
+    UnloadDroppedFiles(files);
+}
+
 void draw_view_area() {
-    Rectangle source = {0, 0, (float)txt.width, (float)txt.height};
-    DrawTexturePro(txt, source, view_area, {0.f, 0.f}, 0.f, WHITE);
+    if (!frame_initialized() || frame->view_width == 0 || frame->view_height == 0) return;
+    float sample_size = zoom * (1 << frame->level);
+    Rectangle source = {0.f, (float)frame->ring_offset, (float)txt.width, (float)txt.height};
+    Rectangle dest = {view_area.x + (frame->view_x - camera.x) * zoom, view_area.y + (frame->view_y - camera.y) * zoom,
+		      txt.width * sample_size, txt.height * sample_size};
+    BeginScissorMode(view_area.x, view_area.y, view_area.width, view_area.height);
+    DrawTexturePro(txt, source, dest, {0.f, 0.f}, 0.f, WHITE);
+    EndScissorMode();
 }
 
 int main() {
-    SetRandomSeed(GetTime());
+    // the soups of the automats come from their own generator, see random.h
+    u64 seed = time(NULL);
+    SetRandomSeed(seed);
     InitWindow(window_width, window_height, "hi");
     SetWindowState(FLAG_WINDOW_RESIZABLE);
     SetTargetFPS(max_fps);
     Image h = GenImageColor(cell_cols, cell_rows, COLOR_FROM_U32(dead_col));
     txt = LoadTextureFromImage(h);
+    SetTextureWrap(txt, TEXTURE_WRAP_REPEAT);
     UnloadImage(h);
 
-    active_automat = new Cell_Automat<u32>(ONE_DIM, cell_cols, cell_rows, dead_col, alive_col);
+    active_automat = new Cell_Automat<u8>(ONE_DIM, cell_cols, cell_rows, dead_state, alive_state);
+    active_automat->random_seed = seed;
     active_automat->randomize_cells();
     active_automat->set_ruleset_dec(30);
-    next_automat = new Cell_Automat<u32>(TWO_DIM, cell_cols, cell_rows, dead_col, alive_col);
+    next_automat = new Cell_Automat<u8>(TWO_DIM, cell_cols, cell_rows, dead_state, alive_state);
+    next_automat->random_seed = next_seed(seed);
+    active_automat->set_thread_pool(&pool);
+    next_automat->set_thread_pool(&pool);
 
-    UpdateTexture(txt, active_automat->cells);
+    palette.set(dead_state, dead_col);
+    palette.set(alive_state, alive_col);
+    sim.start(active_automat);
 
     std::cout << "alive color = " << alive_col << "\ndead color = " << dead_col << "\n";
     control_layout.set_spacing(min_dim / 50.f);
 
     while (!WindowShouldClose()) {
-	double start = GetTime();
-
 	if (IsWindowResized()) {
 	    resize();
 	}
 
+	update_view_texture();
+	update_camera();
+	load_dropped_patterns();
+
 	BeginDrawing();
 	ClearBackground(BLACK);
 
 	draw_view_area();
 	controls();
 
-	UpdateTexture(txt, active_automat->cells);
 	EndDrawing();
-
-	double end = GetTime();
-	seconds_passed += end - start;
     }
 
+    sim.stop();
     UnloadTexture(txt);
     CloseWindow();
     return 0;
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include "common.h"
+
+// display colors of the cell states, the automats only store states.
+// colors are RGBA in memory order, like the pixels of a raylib texture
+struct Palette {
+    u32 colors[256] = {};
+    // changes with every color, so a viewer knows it has to recolor everything
+    u64 version = 0;
+
+    void set(u8 state, u32 color) {
+	colors[state] = color;
+	version++;
+    }
+};
+
+// expands states into pixels with one table lookup per cell.
+// the loop has no branches, so the compiler unrolls it and uses gathers where there are any
+static void colorize(const u8* states, u32* pixels, size_t count, const Palette& palette) {
+    const u32* colors = palette.colors;
+    for (size_t i = 0; i < count; ++i) {
+	pixels[i] = colors[states[i]];
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <cmath>
+#include "common.h"
+
+// counter based random numbers: a value depends only on the seed and its counter, so any part
+// of a fill can be drawn on any thread in any order and the fill is the same for a seed.
+// two rounds of the splitmix64 finalizer over the counter, keyed with the seed
+static u64 random_u64(u64 seed, u64 counter) {
+    u64 x = (counter + 1) * 0x9e3779b97f4a7c15 ^ seed;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    x ^= x >> 31;
+    x = (x + seed) * 0xd6e8feb86659fd93;
+    x = (x ^ (x >> 32)) * 0xd6e8feb86659fd93;
+    return x ^ (x >> 32);
+}
+
+// fraction of alive cells as 32 bit fixed point, 1 << 32 is every cell
+static u64 random_density(double density) {
+    if (!(density > 0.0)) return 0;
+    if (density >= 1.0) return u64(1) << 32;
+    return (u64)llround(density * 4294967296.0);
+}
+
+// 64 cells at once, each alive with probability density / 2^32. the bits of the density are
+// applied from the lowest set one up, a set bit ors in a random word and a clear one ands it,
+// so every bit halves or completes the probability. 50% takes one draw, any density at most 32
+static u64 random_cells(u64 seed, u64 counter, u64 density) {
+    if (density == 0) return 0;
+    if (density >= u64(1) << 32) return ~u64(0);
+    u64 word = 0;
+    for (int b = __builtin_ctzll(density); b < 32; ++b) {
+	u64 r = random_u64(seed, counter * 32 + b);
+	word = BIT_AT(b, density) ? word | r : word & r;
+    }
+    return word;
+}
+
+// the seed after seed, for a sequence of fills from one seed
+static u64 next_seed(u64 seed) {
+    return random_u64(seed, ~u64(0));
+}
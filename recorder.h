@@ -0,0 +1,260 @@
+#pragma once
+#include <cassert>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <vector>
+#include <unistd.h>
+#include "common.h"
+#include "cell_automata.h"
+#include "snapshot.h"
+
+// a recorded generation. keyframes hold the packed rows, the frames between them the xor with
+// the generation recorded before. both are run length encoded over whole words: a token word
+// holds the count of zero words to skip in its upper half and the count of the literal words
+// that follow it in the lower half
+struct Record_Frame {
+    u64 generation = 0;
+    bool keyframe = false;
+    std::vector<u64> data;
+    // offset in the spill file once the data moved there, -1 while it is in memory
+    long offset = -1;
+    size_t words = 0;
+};
+
+// history of the generations a Sim_Thread or a headless run stepped through. every generation
+// is seekable in bounded time, a keyframe and at most keyframe_interval - 1 deltas are applied.
+// a soup that settles down costs a few words per generation. hashlife only records its cells,
+// the universe outside them is gone after a seek
+class Recorder {
+public:
+    ~Recorder() {
+	set_spill_path(NULL);
+    }
+
+    // generations from one keyframe to the next
+    size_t keyframe_interval = 64;
+    // once the frames in memory take more, the oldest move to the spill file or are dropped
+    size_t memory_limit = 256u << 20;
+    size_t memory_bytes = 0;
+    u64 spilled_bytes = 0;
+    // encoded bytes of every frame recorded so far, dropped and spilled ones included
+    u64 recorded_bytes = 0;
+
+    // frames over the memory limit go to this file instead of being dropped, NULL stops spilling.
+    // the file is scratch space, it is rewritten and only read back by this recorder
+    bool set_spill_path(const char* path) {
+	if (spill) {
+	    bool lost = false;
+	    for (Record_Frame& frame : frames) {
+		if (frame.offset >= 0 && !load(frame)) {
+		    lost = true;
+		    break;
+		}
+	    }
+	    fclose(spill);
+	    spill = NULL;
+	    spilled_frames = 0;
+	    spilled_bytes = 0;
+	    if (lost) {
+		std::cout << "recorder: the spill file could not be read back, the recording is dropped\n";
+		clear();
+	    }
+	}
+	if (!path) return true;
+	spill = fopen(path, "w+b");
+	if (!spill) std::cout << "recorder: could not open " << path << "\n";
+	return spill != NULL;
+    }
+
+    void clear() {
+	frames.clear();
+	memory_bytes = 0;
+	if (spill && ftruncate(fileno(spill), 0) != 0) std::cout << "recorder: could not empty the spill file\n";
+	spilled_bytes = 0;
+	spilled_frames = 0;
+	since_keyframe = 0;
+    }
+
+    bool empty() const {
+	return frames.empty();
+    }
+
+    size_t frame_count() const {
+	return frames.size();
+    }
+
+    u64 first_generation() const {
+	return frames.empty() ? 0 : frames.front().generation;
+    }
+
+    u64 last_generation() const {
+	return frames.empty() ? 0 : frames.back().generation;
+    }
+
+    // records the current generation. an automat of another size or a generation that is
+    // not after the last recorded one (restart, seek) cuts the history off there
+    template<typename T> void record(Cell_Automat<T>& automat) {
+	if (automat.type != type || automat.width != width || automat.height != height) {
+	    clear();
+	    type = automat.type;
+	    width = automat.width;
+	    height = automat.height;
+	}
+	while (!frames.empty() && frames.back().generation >= automat.generation) {
+	    memory_bytes -= frames.back().data.size() * sizeof(u64);
+	    frames.pop_back();
+	    since_keyframe = keyframe_interval;
+	}
+	spilled_frames = std::min(spilled_frames, frames.size());
+	if (frames.empty()) since_keyframe = keyframe_interval;
+	size_t words = WORDS_FOR(width) * height;
+	current.resize(words);
+	snapshot_rows(automat, current.data());
+	Record_Frame frame;
+	frame.generation = automat.generation;
+	frame.keyframe = since_keyframe >= keyframe_interval;
+	if (frame.keyframe) {
+	    encode(current.data(), NULL, words, frame.data);
+	    since_keyframe = 0;
+	}
+	else {
+	    encode(current.data(), previous.data(), words, frame.data);
+	}
+	since_keyframe++;
+	previous.swap(current);
+	memory_bytes += frame.data.size() * sizeof(u64);
+	recorded_bytes += frame.data.size() * sizeof(u64);
+	frames.push_back(std::move(frame));
+	trim();
+    }
+
+    // restores the latest recorded generation at or before generation, false if there is none
+    // or the automat has another size than the recording
+    template<typename T> bool seek(Cell_Automat<T>& automat, u64 generation) {
+	if (frames.empty() || generation < frames.front().generation) return false;
+	if (automat.type != type || automat.width != width || automat.height != height) return false;
+	size_t end = 0;
+	size_t count = frames.size();
+	// frames are in generation order
+	while (count > 0) {
+	    size_t half = count / 2;
+	    if (frames[end + half].generation <= generation) {
+		end += half + 1;
+		count -= half + 1;
+	    }
+	    else {
+		count = half;
+	    }
+	}
+	size_t first = end - 1;
+	while (!frames[first].keyframe) first--;
+	size_t words = WORDS_FOR(width) * height;
+	current.assign(words, 0);
+	for (size_t i = first; i < end; ++i) {
+	    if (!decode(frames[i], current.data(), words)) {
+		std::cout << "recorder: could not read generation " << frames[i].generation << " back from the spill file\n";
+		return false;
+	    }
+	}
+	automat.generation = frames[end - 1].generation;
+	restore_rows(automat, current.data());
+	return true;
+    }
+
+private:
+    std::deque<Record_Frame> frames;
+    Automata_Type type = AUTOMATA_TYPE_MAX;
+    size_t width = 0;
+    size_t height = 0;
+    size_t since_keyframe = 0;
+    // packed rows of the last recorded generation and of the one being recorded
+    std::vector<u64> previous;
+    std::vector<u64> current;
+    std::vector<u64> scratch;
+    FILE* spill = NULL;
+    // frames before this one are in the spill file
+    size_t spilled_frames = 0;
+
+    static void encode(const u64* words, const u64* base, size_t count, std::vector<u64>& out) {
+	out.clear();
+	size_t i = 0;
+	while (i < count) {
+	    size_t zeros = 0;
+	    while (i < count && (words[i] ^ (base ? base[i] : 0)) == 0 && zeros < 0xFFFFFFFF) {
+		zeros++;
+		i++;
+	    }
+	    size_t token = out.size();
+	    out.push_back(0);
+	    size_t literals = 0;
+	    while (i < count && (words[i] ^ (base ? base[i] : 0)) != 0 && literals < 0xFFFFFFFF) {
+		out.push_back(words[i] ^ (base ? base[i] : 0));
+		literals++;
+		i++;
+	    }
+	    out[token] = (u64)zeros << 32 | literals;
+	}
+	out.shrink_to_fit();
+    }
+
+    // xors the frame into count words, a keyframe is applied to zeros. false if a spilled
+    // frame can not be read back or does not fit, words is then undefined
+    bool decode(Record_Frame& frame, u64* words, size_t count) {
+	const std::vector<u64>* data = &frame.data;
+	if (frame.offset >= 0) {
+	    if (!read_spilled(frame, scratch)) return false;
+	    data = &scratch;
+	}
+	size_t at = 0;
+	for (size_t t = 0; t < data->size();) {
+	    u64 token = (*data)[t++];
+	    at += token >> 32;
+	    u64 literals = token & 0xFFFFFFFF;
+	    if (at + literals > count || t + literals > data->size()) return false;
+	    for (; literals > 0; --literals) words[at++] ^= (*data)[t++];
+	}
+	return true;
+    }
+
+    bool read_spilled(const Record_Frame& frame, std::vector<u64>& out) {
+	out.resize(frame.words);
+	if (fseek(spill, frame.offset, SEEK_SET) != 0) return false;
+	return fread(out.data(), sizeof(u64), frame.words, spill) == frame.words;
+    }
+
+    bool load(Record_Frame& frame) {
+	if (!read_spilled(frame, frame.data)) return false;
+	frame.offset = -1;
+	memory_bytes += frame.words * sizeof(u64);
+	return true;
+    }
+
+    // moves the oldest frames to the spill file, or drops the oldest keyframe and its deltas.
+    // without a spill file the newest keyframe and its deltas always stay
+    void trim() {
+	while (memory_bytes > memory_limit) {
+	    if (spill) {
+		if (spilled_frames >= frames.size()) break;
+		Record_Frame& frame = frames[spilled_frames++];
+		fseek(spill, 0, SEEK_END);
+		frame.offset = ftell(spill);
+		frame.words = frame.data.size();
+		fwrite(frame.data.data(), sizeof(u64), frame.words, spill);
+		spilled_bytes += frame.words * sizeof(u64);
+		memory_bytes -= frame.words * sizeof(u64);
+		frame.data = std::vector<u64>();
+		continue;
+	    }
+	    size_t group = 1;
+	    while (group < frames.size() && !frames[group].keyframe) group++;
+	    if (group == frames.size()) break;
+	    for (size_t i = 0; i < group; ++i) {
+		memory_bytes -= frames.front().data.size() * sizeof(u64);
+		frames.pop_front();
+	    }
+	}
+    }
+};
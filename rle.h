@@ -0,0 +1,339 @@
+#pragma once
+#include <cassert>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "common.h"
+#include "cell_automata.h"
+
+// run length encoded patterns as golly and the lifewiki write them:
+//   #C comment lines
+//   x = 3, y = 3, rule = B3/S23
+//   bo$2bo$3o!
+// b or . is a dead cell, o an alive one, A to X and p to y followed by A to X are the
+// states of multi state rules, $ ends a row and ! the pattern. a number in front repeats the
+// next cell or row end
+
+// reads a file in chunks, so patterns of any size never sit in memory as text
+class Rle_Reader {
+public:
+    ~Rle_Reader() {
+	close();
+    }
+
+    size_t width = 0;
+    size_t height = 0;
+    // empty if the header has no rule
+    std::string rule;
+
+    // reads the header, false if the file does not open or has no header line
+    bool open(const char* path) {
+	close();
+	file = fopen(path, "rb");
+	if (!file) {
+	    std::cout << "rle: could not open " << path << "\n";
+	    return false;
+	}
+	while (true) {
+	    int c = next();
+	    while (c == ' ' || c == '\t' || c == '\r' || c == '\n') c = next();
+	    if (c == EOF) break;
+	    if (c == '#') {
+		skip_line();
+		continue;
+	    }
+	    std::string line(1, (char)c);
+	    for (c = next(); c != EOF && c != '\n'; c = next()) line += (char)c;
+	    if (parse_header(line)) return true;
+	    break;
+	}
+	std::cout << "rle: " << path << " has no \"x = .., y = ..\" header\n";
+	close();
+	return false;
+    }
+
+    void close() {
+	if (file) fclose(file);
+	file = NULL;
+	length = at = 0;
+    }
+
+    // calls on_run(x, y, count, state) for every run of cells that are not dead.
+    // false if the pattern is malformed, the runs before the error were already reported
+    template<typename F> bool read(F on_run) {
+	assert(file && "rle not open");
+	size_t x = 0;
+	size_t y = 0;
+	size_t count = 0;
+	int prefix = 0;
+	for (int c = next(); c != EOF; c = next()) {
+	    if (c >= '0' && c <= '9') {
+		count = count * 10 + (c - '0');
+		continue;
+	    }
+	    size_t run = count ? count : 1;
+	    if (c == 'b' || c == '.') {
+		x += run;
+	    }
+	    else if (c == 'o' || (c >= 'A' && c <= 'X')) {
+		int state = c == 'o' ? 1 : c - 'A' + 1;
+		if (prefix) state += (prefix - 'p' + 1) * 24;
+		if (state > 255) return false;
+		on_run(x, y, run, (u8)state);
+		x += run;
+		prefix = 0;
+	    }
+	    else if (c >= 'p' && c <= 'y') {
+		prefix = c;
+		continue;
+	    }
+	    else if (c == '$') {
+		y += run;
+		x = 0;
+	    }
+	    else if (c == '!') {
+		return true;
+	    }
+	    else if (c == '#') {
+		skip_line();
+	    }
+	    else if (!isspace(c)) {
+		std::cout << "rle: unexpected '" << (char)c << "' in row " << y << "\n";
+		return false;
+	    }
+	    count = 0;
+	}
+	// golly also reads files without the !
+	return true;
+    }
+
+private:
+    FILE* file = NULL;
+    char buffer[1 << 16];
+    size_t length = 0;
+    size_t at = 0;
+
+    int next() {
+	if (at == length) {
+	    length = fread(buffer, 1, sizeof(buffer), file);
+	    at = 0;
+	    if (length == 0) return EOF;
+	}
+	return (unsigned char)buffer[at++];
+    }
+
+    void skip_line() {
+	for (int c = next(); c != EOF && c != '\n'; c = next());
+    }
+
+    // "x = 3, y = 3, rule = B3/S23", x and y may come in any order.
+    // the rule comes last and is the rest of the line, bounded grids like B3/S23:T16,16 have a comma in it
+    bool parse_header(const std::string& line) {
+	bool has_x = false;
+	bool has_y = false;
+	size_t start = 0;
+	while (start < line.size()) {
+	    size_t end = line.find(',', start);
+	    if (end == std::string::npos) end = line.size();
+	    std::string pair = line.substr(start, end - start);
+	    size_t pair_start = start;
+	    start = end + 1;
+	    size_t equals = pair.find('=');
+	    if (equals == std::string::npos) continue;
+	    std::string key = trim(pair.substr(0, equals));
+	    if (key == "rule") {
+		rule = trim(line.substr(pair_start + equals + 1));
+		break;
+	    }
+	    std::string value = trim(pair.substr(equals + 1));
+	    if (key == "x") {
+		width = strtoull(value.c_str(), NULL, 10);
+		has_x = true;
+	    }
+	    else if (key == "y") {
+		height = strtoull(value.c_str(), NULL, 10);
+		has_y = true;
+	    }
+	}
+	return has_x && has_y;
+    }
+
+    static std::string trim(const std::string& s) {
+	size_t begin = s.find_first_not_of(" \t\r");
+	size_t end = s.find_last_not_of(" \t\r");
+	return begin == std::string::npos ? "" : s.substr(begin, end - begin + 1);
+    }
+};
+
+// writes rows one after the other. row_bits() takes rows packed 64 cells per word and finds
+// the runs with bit scans, so empty words and long runs cost one step instead of 64
+class Rle_Writer {
+public:
+    ~Rle_Writer() {
+	close();
+    }
+
+    bool open(const char* path, size_t width, size_t height, const std::string& rule) {
+	close();
+	file = fopen(path, "w");
+	if (!file) {
+	    std::cout << "rle: could not open " << path << " for writing\n";
+	    return false;
+	}
+	this->width = width;
+	fprintf(file, "x = %zu, y = %zu", width, height);
+	if (!rule.empty()) fprintf(file, ", rule = %s", rule.c_str());
+	fprintf(file, "\n");
+	line_length = 0;
+	rows_ended = 0;
+	return true;
+    }
+
+    // the cells of the next row, bits after the width are ignored
+    void row_bits(const u64* words) {
+	assert(file && "rle not open");
+	size_t x = 0;
+	while (x < width) {
+	    size_t start = find(words, x, false);
+	    if (start >= width) break;
+	    size_t end = std::min(find(words, start, true), width);
+	    run(start - x, 'b');
+	    run(end - start, 'o');
+	    x = end;
+	}
+	rows_ended++;
+    }
+
+    // ends the pattern, empty rows at the end are left out
+    bool close() {
+	if (!file) return false;
+	bool ok = fprintf(file, "!\n") > 0;
+	ok = fclose(file) == 0 && ok;
+	file = NULL;
+	return ok;
+    }
+
+private:
+    FILE* file = NULL;
+    size_t width = 0;
+    size_t line_length = 0;
+    // rows finished since the last run was written, written as one $ run before the next
+    size_t rows_ended = 0;
+
+    // first cell at or after x that is alive, or dead if inverted
+    size_t find(const u64* words, size_t x, bool inverted) const {
+	size_t count = (width + 63) / 64;
+	size_t i = x / 64;
+	u64 flip = inverted ? ~u64(0) : 0;
+	u64 word = (words[i] ^ flip) & (~u64(0) << (x % 64));
+	while (!word) {
+	    if (++i >= count) return width;
+	    word = words[i] ^ flip;
+	}
+	return i * 64 + __builtin_ctzll(word);
+    }
+
+    void run(size_t count, char tag) {
+	if (!count) return;
+	if (rows_ended) {
+	    token(rows_ended, '$');
+	    rows_ended = 0;
+	}
+	token(count, tag);
+    }
+
+    void token(size_t count, char tag) {
+	char text[32];
+	int length = 0;
+	if (count > 1) length = snprintf(text, sizeof(text), "%zu", count);
+	text[length++] = tag;
+	// golly keeps lines at 70 characters
+	if (line_length + length > 70) {
+	    fputc('\n', file);
+	    line_length = 0;
+	}
+	fwrite(text, 1, length, file);
+	line_length += length;
+    }
+};
+
+// rule as the header of an rle names it, 1D rules are wolfram numbers after a W
+template<typename T> std::string rle_rule(const Cell_Automat<T>& automat) {
+    if (automat.type == ONE_DIM) return "W" + std::to_string(automat.one_dim_rules);
+    return automat.life_rule.to_string();
+}
+
+// loads the pattern into the middle of the automat (1D patterns start at the first row),
+// cells that do not fit are dropped. the pattern becomes the state restart() returns to,
+// and a rule in the header replaces the rule of the automat. the automats have two states,
+// a pattern with other states or a malformed one is rejected and the automat stays as it was
+template<typename T> bool load_rle(Cell_Automat<T>& automat, const char* path) {
+    Rle_Reader reader;
+    if (!reader.open(path)) return false;
+    long x0 = ((long)automat.width - (long)reader.width) / 2;
+    long y0 = automat.type == ONE_DIM ? 0 : ((long)automat.height - (long)reader.height) / 2;
+    if (reader.width > automat.width || reader.height > automat.height) {
+	std::cout << "rle: the " << reader.width << "x" << reader.height << " pattern is cut to " << automat.width << "x" << automat.height << "\n";
+    }
+    std::vector<T> cells(automat.size, automat.zero);
+    u8 other_state = 0;
+    bool ok = reader.read([&](size_t x, size_t y, size_t count, u8 state) {
+	if (state != 1) {
+	    other_state = state;
+	    return;
+	}
+	long row = y0 + (long)y;
+	if (row < 0 || row >= (long)automat.height) return;
+	long begin = std::max(x0 + (long)x, 0L);
+	long end = std::min(x0 + (long)(x + count), (long)automat.width);
+	for (long i = begin; i < end; ++i) cells[INDEX(i, row, automat.width)] = automat.one;
+    });
+    if (other_state) {
+	std::cout << "rle: " << path << " has cells in state " << +other_state << ", only two state patterns can be loaded\n";
+	return false;
+    }
+    if (!ok) return false;
+    if (!reader.rule.empty()) {
+	const char* rule = reader.rule.c_str();
+	if (automat.type == ONE_DIM && (rule[0] == 'W' || rule[0] == 'w')) automat.set_ruleset_dec(strtoull(rule + 1, NULL, 10) & 0xFF);
+	else if (automat.type == TWO_DIM && !automat.set_ruleset(rule)) {
+	    std::cout << "rle: keeping the rule " << automat.life_rule.to_string() << ", " << rule << " does not parse\n";
+	}
+    }
+    automat.generation = 0;
+    automat.set_cells(cells.data());
+    return true;
+}
+
+// the whole grid, 1D rows in generation order. the bit engines hand over their packed rows
+// without unpacking the cells, the others pack one row at a time
+template<typename T> bool save_rle(Cell_Automat<T>& automat, const char* path) {
+    Rle_Writer writer;
+    if (!writer.open(path, automat.width, automat.height, rle_rule(automat))) return false;
+    bool packed_rows = automat.uses_bits() || automat.uses_elementary_bits();
+    const T* cells = packed_rows ? NULL : automat.sync_cells();
+    std::vector<u64> packed((automat.width + 63) / 64);
+    for (size_t r = 0; r < automat.height; ++r) {
+	size_t y = (automat.first_row() + r) % automat.height;
+	if (automat.uses_bits()) {
+	    writer.row_bits(automat.bits.cells.row(y));
+	    continue;
+	}
+	if (automat.uses_elementary_bits()) {
+	    writer.row_bits(automat.elementary.row(y));
+	    continue;
+	}
+	for (u64& word : packed) word = 0;
+	const T* row = cells + y * automat.width;
+	for (size_t x = 0; x < automat.width; ++x) {
+	    if (row[x] == automat.one) BIT_SET(x % 64, packed[x / 64]);
+	}
+	writer.row_bits(packed.data());
+    }
+    return writer.close();
+}
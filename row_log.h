@@ -0,0 +1,146 @@
+#pragma once
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "common.h"
+
+// append only log of 1D generations that scrolled out of the window of an unbounded automat.
+// the file starts with "CA1D" and the width as u64, every record is the generation as u64,
+// the payload size in bytes as u64 and the payload: the row packed 64 cells per word,
+// with runs of zero words collapsed.
+// the payload is a sequence of (varint zero words, varint literal words, literal words)
+class Row_Log {
+public:
+    ~Row_Log() {
+	close();
+    }
+
+    size_t width = 0;
+    u64 rows_written = 0;
+    u64 bytes_written = 0;
+
+    bool is_open() const {
+	return file != NULL;
+    }
+
+    bool open_write(const char* path, size_t width) {
+	close();
+	file = fopen(path, "wb");
+	if (!file) {
+	    std::cout << "row log: could not open " << path << " for writing\n";
+	    return false;
+	}
+	this->width = width;
+	rows_written = 0;
+	u64 w = width;
+	fwrite(magic, 1, 4, file);
+	fwrite(&w, sizeof(w), 1, file);
+	bytes_written = 4 + sizeof(w);
+	return true;
+    }
+
+    bool open_read(const char* path) {
+	close();
+	file = fopen(path, "rb");
+	if (!file) {
+	    std::cout << "row log: could not open " << path << " for reading\n";
+	    return false;
+	}
+	char header[4];
+	u64 w = 0;
+	if (fread(header, 1, 4, file) != 4 || memcmp(header, magic, 4) || fread(&w, sizeof(w), 1, file) != 1) {
+	    std::cout << "row log: " << path << " is not a row log\n";
+	    close();
+	    return false;
+	}
+	width = w;
+	return true;
+    }
+
+    void close() {
+	if (file) fclose(file);
+	file = NULL;
+    }
+
+    // bits holds the cells of the row, 64 per word, bits after the width are ignored
+    void append(u64 generation, const u64* bits) {
+	assert(file && "row log not open");
+	size_t words = (width + 63) / 64;
+	payload.clear();
+	size_t i = 0;
+	while (i < words) {
+	    size_t zeros = 0;
+	    while (i + zeros < words && masked(bits, i + zeros, words) == 0) zeros++;
+	    size_t literals = 0;
+	    while (i + zeros + literals < words && masked(bits, i + zeros + literals, words) != 0) literals++;
+	    put_varint(zeros);
+	    put_varint(literals);
+	    for (size_t l = 0; l < literals; ++l) {
+		u64 word = masked(bits, i + zeros + l, words);
+		const u8* b = (const u8*)&word;
+		payload.insert(payload.end(), b, b + sizeof(word));
+	    }
+	    i += zeros + literals;
+	}
+	u64 size = payload.size();
+	fwrite(&generation, sizeof(generation), 1, file);
+	fwrite(&size, sizeof(size), 1, file);
+	fwrite(payload.data(), 1, payload.size(), file);
+	rows_written++;
+	bytes_written += 2 * sizeof(u64) + payload.size();
+    }
+
+    // next record of a log opened with open_read(), false at the end of the file
+    bool read(u64& generation, std::vector<u64>& bits) {
+	assert(file && "row log not open");
+	u64 size = 0;
+	if (fread(&generation, sizeof(generation), 1, file) != 1) return false;
+	if (fread(&size, sizeof(size), 1, file) != 1) return false;
+	payload.resize(size);
+	if (fread(payload.data(), 1, size, file) != size) return false;
+	size_t words = (width + 63) / 64;
+	bits.assign(words, 0);
+	size_t at = 0;
+	size_t i = 0;
+	while (at < payload.size()) {
+	    i += get_varint(at);
+	    size_t literals = get_varint(at);
+	    if (i + literals > words || at + literals * sizeof(u64) > payload.size()) return false;
+	    memcpy(&bits[i], &payload[at], literals * sizeof(u64));
+	    at += literals * sizeof(u64);
+	    i += literals;
+	}
+	return true;
+    }
+
+private:
+    static constexpr char magic[4] = {'C', 'A', '1', 'D'};
+    FILE* file = NULL;
+    std::vector<u8> payload;
+
+    u64 masked(const u64* bits, size_t i, size_t words) const {
+	size_t tail = width % 64;
+	if (i == words - 1 && tail) return bits[i] & ((u64(1) << tail) - 1);
+	return bits[i];
+    }
+
+    void put_varint(u64 value) {
+	while (value >= 0x80) {
+	    payload.push_back((u8)(value | 0x80));
+	    value >>= 7;
+	}
+	payload.push_back((u8)value);
+    }
+
+    u64 get_varint(size_t& at) const {
+	u64 value = 0;
+	for (int shift = 0; at < payload.size() && shift < 64; shift += 7) {
+	    u8 b = payload[at++];
+	    value |= u64(b & 0x7F) << shift;
+	    if (!(b & 0x80)) break;
+	}
+	return value;
+    }
+};
@@ -0,0 +1,431 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cell_automata.h"
+#include "lod_pyramid.h"
+#include "recorder.h"
+
+// the part of the world the gui shows, in cells, and the level of detail it wants.
+// the frames only carry the samples of this window, so what is copied and uploaded
+// per frame is bounded by the screen and not by the world
+struct Sim_View {
+    long x0 = 0;
+    long y0 = 0;
+    // exclusive, clipped to the world
+    long x1 = 1L << 40;
+    long y1 = 1L << 40;
+    // a sample of level k covers 2^k x 2^k cells
+    int level = 0;
+
+    bool operator==(const Sim_View& other) const {
+	return x0 == other.x0 && y0 == other.y0 && x1 == other.x1 && y1 == other.y1 && level == other.level;
+    }
+};
+
+// everything the gui needs to draw a generation and its controls,
+// copied out of the automat so the gui never reads it while the sim thread steps
+template<typename T> struct Sim_Frame {
+    // the samples of the view window, view_width x view_height
+    std::vector<T> cells;
+    // size of the world in cells
+    size_t width = 0;
+    size_t height = 0;
+    // cell of the first sample and samples of the window, see Sim_View.
+    // 1D automats send every row of the ring in storage order, so a new generation only
+    // dirties its own row, and ring_offset is the sample row of the oldest generation
+    size_t view_x = 0;
+    size_t view_y = 0;
+    size_t view_width = 0;
+    size_t view_height = 0;
+    int level = 0;
+    size_t generation = 0;
+    Automata_Type type = AUTOMATA_TYPE_MAX;
+    Engine engine = REFERENCE_ENGINE;
+    Boundary boundary = BOUNDARY_TORUS;
+    u64 one_dim_rules = 0;
+    std::string life_rule;
+    bool uses_bits = false;
+    bool uses_hashlife = false;
+    size_t tiles_computed = 0;
+    size_t tiles_total = 0;
+    bool streaming = false;
+    // row of the oldest generation, see Cell_Automat::first_row()
+    size_t first_row = 0;
+    size_t ring_offset = 0;
+    bool spilling = false;
+    u64 spilled_rows = 0;
+    u64 spilled_bytes = 0;
+    // State_Hash of all cells, not only of the view window
+    u64 hash = 0;
+    // generations the recorder can seek to, see Sim_Thread::recorder
+    bool recording = false;
+    u64 recorded_first = 0;
+    u64 recorded_last = 0;
+    size_t recorded_bytes = 0;
+    // counts published frames, a new value means the cells changed
+    u64 id = 0;
+    // samples that changed since the last published frame
+    Dirty_Rows dirty;
+};
+
+// lock free single producer / single consumer triple buffer.
+// the producer always owns the back slot and the consumer the front slot,
+// publishing and acquiring swap them with the middle slot
+template<typename F> class Triple_Buffer {
+public:
+    F& back() {
+	return slots[back_index];
+    }
+
+    const F& front() const {
+	return slots[front_index];
+    }
+
+    void publish() {
+	u32 previous = middle.exchange(back_index | fresh_bit, std::memory_order_acq_rel);
+	back_index = previous & index_mask;
+    }
+
+    // swaps in the latest published slot, false if nothing new was published
+    bool acquire() {
+	if (!(middle.load(std::memory_order_acquire) & fresh_bit)) return false;
+	u32 previous = middle.exchange(front_index, std::memory_order_acq_rel);
+	front_index = previous & index_mask;
+	return true;
+    }
+
+    // true once the consumer took the last published slot
+    bool taken() const {
+	return !(middle.load(std::memory_order_acquire) & fresh_bit);
+    }
+
+private:
+    static constexpr u32 index_mask = 3;
+    static constexpr u32 fresh_bit = 4;
+    F slots[3];
+    u32 back_index = 0;
+    u32 front_index = 1;
+    std::atomic<u32> middle = 2;
+};
+
+// how fast the sim thread steps while playing
+enum Sim_Pace {
+    // target_rate generations per second
+    PACE_RATE,
+    // gens_per_frame generations for every frame the gui takes
+    PACE_PER_FRAME,
+    // as many generations as fit into step_budget between two published frames
+    PACE_MAX,
+    PACE_MAX_ENUM
+};
+
+// runs apply_rules() on its own thread at its own rate, the gui talks to it through
+// commands and reads finished generations from the triple buffer
+template<typename T> class Sim_Thread {
+public:
+    typedef std::function<void(Cell_Automat<T>& automat)> Command;
+
+    ~Sim_Thread() {
+	stop();
+    }
+
+    Triple_Buffer<Sim_Frame<T>> frames;
+    // target generations per second while playing, <= 0 pauses
+    std::atomic<float> target_rate = 60.f;
+    std::atomic<int> gens_per_frame = 1;
+    std::atomic<Sim_Pace> pace = PACE_RATE;
+    // seconds the thread steps before it looks at commands and publishes again
+    std::atomic<float> step_budget = 0.008f;
+    std::atomic<bool> playing = false;
+    // generations per second measured over the last half second
+    std::atomic<float> achieved_rate = 0.f;
+    // every generation the thread steps to is recorded while set
+    std::atomic<bool> recording = false;
+    // only touched on the sim thread, commands can seek in it
+    Recorder recorder;
+
+    void start(Cell_Automat<T>* first) {
+	assert(!running && "sim thread already running");
+	automat = first;
+	running = true;
+	changed = true;
+	thread = std::thread([this] { run(); });
+    }
+
+    void stop() {
+	if (!running) return;
+	{
+	    std::lock_guard<std::mutex> lock(mutex);
+	    running = false;
+	}
+	wake.notify_all();
+	thread.join();
+    }
+
+    // the command runs on the sim thread between two generations
+    void submit(Command command) {
+	{
+	    std::lock_guard<std::mutex> lock(mutex);
+	    commands.push_back(std::move(command));
+	}
+	wake.notify_all();
+    }
+
+    // the automat the following commands and generations apply to
+    void set_automat(Cell_Automat<T>* next) {
+	{
+	    std::lock_guard<std::mutex> lock(mutex);
+	    pending_automat = next;
+	}
+	wake.notify_all();
+    }
+
+    // the window the next frames are cut from
+    void set_view(const Sim_View& view) {
+	{
+	    std::lock_guard<std::mutex> lock(mutex);
+	    pending_view = view;
+	    view_requested = true;
+	}
+	wake.notify_all();
+    }
+
+    // one generation even when not playing
+    void request_step() {
+	steps_requested++;
+	wake.notify_all();
+    }
+
+private:
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<Command> commands;
+    // only touched by the sim thread once running
+    Cell_Automat<T>* automat = NULL;
+    Cell_Automat<T>* pending_automat = NULL;
+    std::atomic<int> steps_requested = 0;
+    bool running = false;
+    bool changed = false;
+    u64 published = 0;
+    Sim_View pending_view;
+    bool view_requested = false;
+    Sim_View view;
+    Lod_Pyramid<T> pyramid;
+    State_Hash<T> state_hash;
+    // window of the last published frame, its dirty spans are only valid for the same window
+    Sim_View published_view;
+    Cell_Automat<T>* published_automat = NULL;
+    Cell_Automat<T>* rate_automat = NULL;
+    size_t rate_generation = 0;
+    std::chrono::steady_clock::time_point rate_start;
+
+    void run_commands() {
+	std::vector<Command> todo;
+	{
+	    std::lock_guard<std::mutex> lock(mutex);
+	    todo.swap(commands);
+	    if (pending_automat) {
+		automat = pending_automat;
+		pending_automat = NULL;
+		// the viewer still shows the old automat
+		automat->dirty.mark_all();
+		recorder.clear();
+		changed = true;
+	    }
+	    if (view_requested) {
+		view = pending_view;
+		view_requested = false;
+		changed = true;
+	    }
+	}
+	for (Command& command : todo) {
+	    command(*automat);
+	    changed = true;
+	}
+    }
+
+    // false if the automat did not advance, a bounded 1D automat that is full
+    bool step() {
+	size_t generation = automat->generation;
+	automat->apply_rules();
+	if (automat->generation == generation) return false;
+	if (recording) recorder.record(*automat);
+	changed = true;
+	return true;
+    }
+
+    void measure_rate(std::chrono::steady_clock::time_point now) {
+	double elapsed = std::chrono::duration<double>(now - rate_start).count();
+	// a switched or restarted automat starts a new measurement
+	if (automat != rate_automat || automat->generation < rate_generation) {
+	    rate_automat = automat;
+	    rate_generation = automat->generation;
+	    rate_start = now;
+	    return;
+	}
+	if (elapsed < 0.5) return;
+	achieved_rate = (automat->generation - rate_generation) / elapsed;
+	rate_generation = automat->generation;
+	rate_start = now;
+    }
+
+    // copies the current generation into the back slot, but only once the gui took the
+    // previous one, so a slow gui never slows the simulation down
+    void publish() {
+	if (!changed || !frames.taken()) return;
+	Sim_Frame<T>& frame = frames.back();
+	frame.width = automat->width;
+	frame.height = automat->height;
+	frame.generation = automat->generation;
+	frame.type = automat->type;
+	frame.engine = automat->engine;
+	frame.boundary = automat->boundary;
+	frame.one_dim_rules = automat->one_dim_rules;
+	frame.life_rule = automat->life_rule.to_string();
+	frame.uses_bits = automat->uses_bits();
+	frame.uses_hashlife = automat->uses_hashlife();
+	frame.tiles_computed = automat->bits.tiles_computed;
+	frame.tiles_total = automat->bits.tiles_x * automat->bits.tiles_y;
+	frame.streaming = automat->streaming;
+	frame.first_row = automat->first_row();
+	frame.spilling = automat->spill != NULL;
+	frame.spilled_rows = automat->spill ? automat->spill->rows_written : 0;
+	frame.spilled_bytes = automat->spill ? automat->spill->bytes_written : 0;
+	frame.recording = recording;
+	frame.recorded_first = recorder.first_generation();
+	frame.recorded_last = recorder.last_generation();
+	frame.recorded_bytes = recorder.memory_bytes;
+	const T* cells = automat->sync_cells();
+	if (pyramid.width != automat->width || pyramid.height != automat->height) {
+	    pyramid.init(automat->width, automat->height);
+	    state_hash.init(automat->width, automat->height);
+	}
+	pyramid.update(cells, automat->dirty);
+	frame.hash = state_hash.update(cells, automat->dirty);
+	cut_view(frame, cells);
+	automat->dirty.clear();
+	frame.id = ++published;
+	frames.publish();
+	changed = false;
+    }
+
+    // copies the samples of the view window into the frame, the dirty spans carry over
+    // only if the window and the level did not move
+    void cut_view(Sim_Frame<T>& frame, const T* cells) {
+	int level = std::clamp(view.level, 0, (int)pyramid.level_count() - 1);
+	size_t level_width = pyramid.level_widths[level];
+	size_t level_height = pyramid.level_heights[level];
+	long scale = 1L << level;
+	size_t sx0 = std::clamp(view.x0, 0L, (long)automat->width) / scale;
+	size_t sy0 = std::clamp(view.y0, 0L, (long)automat->height) / scale;
+	size_t sx1 = (std::clamp(view.x1, 0L, (long)automat->width) + scale - 1) / scale;
+	size_t sy1 = (std::clamp(view.y1, 0L, (long)automat->height) + scale - 1) / scale;
+	sx1 = std::max(std::min(sx1, level_width), sx0);
+	sy1 = std::max(std::min(sy1, level_height), sy0);
+	// the ring of a 1D automat scrolls through every row, the viewer draws it from ring_offset
+	bool ring = automat->type == ONE_DIM;
+	if (ring) {
+	    sy0 = 0;
+	    sy1 = level_height;
+	}
+	size_t w = sx1 - sx0;
+	size_t h = sy1 - sy0;
+	Sim_View window = {(long)sx0, (long)sy0, (long)sx1, (long)sy1, level};
+	bool same = automat == published_automat && window == published_view;
+
+	frame.view_x = sx0 * scale;
+	frame.view_y = sy0 * scale;
+	frame.view_width = w;
+	frame.view_height = h;
+	frame.level = level;
+	frame.ring_offset = ring ? automat->first_row() / scale : 0;
+	frame.cells.resize(w * h);
+	frame.dirty.init(w, h);
+	if (same) frame.dirty.clear();
+	for (size_t r = 0; r < h; ++r) {
+	    size_t y = sy0 + r;
+	    T* dst = frame.cells.data() + r * w;
+	    if (level == 0) memcpy(dst, cells + y * automat->width + sx0, sizeof(T) * w);
+	    else memcpy(dst, pyramid.levels[level - 1].data() + y * level_width + sx0, sizeof(T) * w);
+	    if (!same) continue;
+	    // the cells under this sample row that changed
+	    for (size_t cy = y * scale; cy < std::min((y + 1) * scale, automat->height); ++cy) {
+		if (!automat->dirty.is_dirty(cy)) continue;
+		size_t b = automat->dirty.begin[cy] / scale;
+		size_t e = (automat->dirty.end[cy] + scale - 1) / scale;
+		frame.dirty.mark(r, std::max(b, sx0) - sx0, std::min(std::max(e, sx0), sx1) - sx0);
+	    }
+	}
+	published_view = window;
+	published_automat = automat;
+    }
+
+    void run() {
+	typedef std::chrono::steady_clock clock;
+	clock::time_point last = clock::now();
+	// generations the target rate asks for that did not run yet
+	double owed = 0.0;
+	while (true) {
+	    {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!running) return;
+	    }
+	    run_commands();
+
+	    clock::time_point now = clock::now();
+	    double elapsed = std::chrono::duration<double>(now - last).count();
+	    last = now;
+	    Sim_Pace current_pace = pace;
+	    float rate = target_rate;
+	    if (playing && current_pace == PACE_RATE && rate > 0.f) {
+		owed += elapsed * rate;
+		// after a stall the sim does not race to catch up
+		if (owed > rate * 0.1 + 1.0) owed = rate * 0.1 + 1.0;
+	    }
+	    else {
+		owed = 0.0;
+	    }
+
+	    for (int steps = steps_requested.exchange(0); steps > 0; --steps) step();
+	    // steps for at most a few milliseconds so commands and publishing keep flowing
+	    clock::time_point budget_end = now + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(step_budget.load()));
+	    if (playing && current_pace == PACE_RATE) {
+		while (owed >= 1.0 && clock::now() < budget_end) {
+		    step();
+		    owed -= 1.0;
+		}
+	    }
+	    else if (playing && current_pace == PACE_PER_FRAME) {
+		// the next batch only once the gui took the last one, every frame shows a batch
+		if (frames.taken()) {
+		    for (int steps = gens_per_frame; steps > 0; --steps) if (!step()) break;
+		}
+	    }
+	    else if (playing && current_pace == PACE_MAX) {
+		// only the last generation of the budget is published
+		while (step() && clock::now() < budget_end);
+	    }
+	    measure_rate(clock::now());
+	    publish();
+
+	    // sleep until the next generation is due, commands wake the thread early
+	    double wait = playing && current_pace == PACE_RATE && rate > 0.f ? (1.0 - owed) / rate : 0.01;
+	    if (wait > 0.01) wait = 0.01;
+	    if (changed || (playing && current_pace != PACE_RATE)) wait = 0.001;
+	    if (wait > 0.0) {
+		std::unique_lock<std::mutex> lock(mutex);
+		wake.wait_for(lock, std::chrono::duration<double>(wait), [this] {
+		    return !running || !commands.empty() || pending_automat || steps_requested > 0;
+		});
+	    }
+	}
+    }
+};
@@ -0,0 +1,265 @@
+#pragma once
+#include <cassert>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "common.h"
+#include "cell_automata.h"
+#include "state_hash.h"
+
+// binary snapshot of an automat, written and read through mmap so the cells go straight
+// between the engine and the page cache. the file is a header page and the rows packed
+// 64 cells per word, every row padded to whole words. 1D rows are the ring as it is stored,
+// the generation tells where it starts
+struct Snapshot_Header {
+    char magic[8];
+    u32 version;
+    u32 type;
+    u64 width;
+    u64 height;
+    u64 generation;
+    // hash of the payload, checked when it is loaded
+    u64 hash;
+    u64 one_dim_rules;
+    u16 birth;
+    u16 survive;
+    u32 boundary;
+    u32 streaming;
+    u32 words_per_row;
+    u64 payload_offset;
+    u64 payload_bytes;
+};
+
+static const char snapshot_magic[8] = {'C', 'A', 'S', 'N', 'A', 'P', '\0', '\0'};
+static constexpr u32 snapshot_version = 1;
+// the payload starts on its own page, so it can be mapped and copied page by page
+static constexpr size_t snapshot_header_bytes = 4096;
+
+static u64 snapshot_payload_hash(const u64* rows, size_t words_per_row, size_t height) {
+    return State_Hash<u64>::hash(rows, words_per_row, height);
+}
+
+template<typename T> Snapshot_Header snapshot_header(const Cell_Automat<T>& automat) {
+    Snapshot_Header header = {};
+    memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+    header.version = snapshot_version;
+    header.type = automat.type;
+    header.width = automat.width;
+    header.height = automat.height;
+    header.generation = automat.generation;
+    header.one_dim_rules = automat.one_dim_rules;
+    header.birth = automat.life_rule.birth;
+    header.survive = automat.life_rule.survive;
+    header.boundary = automat.boundary;
+    header.streaming = automat.streaming;
+    header.words_per_row = WORDS_FOR(automat.width);
+    header.payload_offset = snapshot_header_bytes;
+    header.payload_bytes = sizeof(u64) * header.words_per_row * automat.height;
+    return header;
+}
+
+// packs the rows into dst, the bit engines copy their rows as they are
+template<typename T> void snapshot_rows(Cell_Automat<T>& automat, u64* dst) {
+    size_t words = WORDS_FOR(automat.width);
+    size_t tail = automat.width % WORD_BITS;
+    const T* cells = automat.uses_bits() || automat.uses_elementary_bits() ? NULL : automat.sync_cells();
+    for (size_t y = 0; y < automat.height; ++y) {
+	u64* out = dst + y * words;
+	if (automat.uses_bits() || automat.uses_elementary_bits()) {
+	    memcpy(out, automat.uses_bits() ? automat.bits.cells.row(y) : automat.elementary.row(y), sizeof(u64) * words);
+	    // the bits after the width hold the halo
+	    if (tail) out[words - 1] &= (u64(1) << tail) - 1;
+	    continue;
+	}
+	const T* row = cells + y * automat.width;
+	for (size_t i = 0; i < words; ++i) {
+	    u64 word = 0;
+	    size_t x0 = i * WORD_BITS;
+	    size_t bits = automat.width - x0 < WORD_BITS ? automat.width - x0 : WORD_BITS;
+	    for (size_t b = 0; b < bits; ++b) word |= u64(row[x0 + b] == automat.one) << b;
+	    out[i] = word;
+	}
+    }
+}
+
+// writes rows packed like snapshot_rows() into the automat, its type and size have to match.
+// the bit engines copy the rows as they are, the others unpack them into cells
+template<typename T> void restore_rows(Cell_Automat<T>& automat, const u64* rows) {
+    size_t words = WORDS_FOR(automat.width);
+    if (automat.uses_bits() || automat.uses_elementary_bits()) {
+	for (size_t y = 0; y < automat.height; ++y) {
+	    u64* row = automat.uses_bits() ? automat.bits.cells.row(y) : automat.elementary.row(y);
+	    memcpy(row, rows + y * words, sizeof(u64) * words);
+	}
+	if (automat.uses_bits()) {
+	    automat.bits.set_rule(automat.life_rule);
+	    automat.bits.mark_all_changed();
+	}
+	else for (u8& dirty : automat.elementary.row_dirty) dirty = 1;
+	automat.cells_stale = true;
+	automat.dirty.mark_all();
+	return;
+    }
+    for (size_t y = 0; y < automat.height; ++y) {
+	T* row = automat.cells + y * automat.width;
+	const u64* in = rows + y * words;
+	for (size_t x = 0; x < automat.width; ++x) row[x] = BIT_AT(x % WORD_BITS, in[x / WORD_BITS]) ? automat.one : automat.zero;
+    }
+    automat.load_engine();
+}
+
+// creates the file at its full size and maps it for writing, NULL if that fails
+static u8* create_snapshot_file(const char* path, size_t bytes) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+	std::cout << "snapshot: could not open " << path << " for writing\n";
+	return NULL;
+    }
+    if (ftruncate(fd, bytes) != 0) {
+	std::cout << "snapshot: could not grow " << path << " to " << bytes << " bytes\n";
+	close(fd);
+	return NULL;
+    }
+    void* map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+	std::cout << "snapshot: could not map " << path << "\n";
+	return NULL;
+    }
+    return (u8*)map;
+}
+
+// header and rows that were packed before, hash is filled in here
+static bool write_snapshot_file(const char* path, Snapshot_Header& header, const u64* rows) {
+    header.hash = snapshot_payload_hash(rows, header.words_per_row, header.height);
+    size_t bytes = header.payload_offset + header.payload_bytes;
+    u8* map = create_snapshot_file(path, bytes);
+    if (!map) return false;
+    memcpy(map, &header, sizeof(header));
+    memcpy(map + header.payload_offset, rows, header.payload_bytes);
+    return munmap(map, bytes) == 0;
+}
+
+// packs the rows straight into the mapped file
+template<typename T> bool save_snapshot(Cell_Automat<T>& automat, const char* path) {
+    Snapshot_Header header = snapshot_header(automat);
+    size_t bytes = header.payload_offset + header.payload_bytes;
+    u8* map = create_snapshot_file(path, bytes);
+    if (!map) return false;
+    u64* rows = (u64*)(map + header.payload_offset);
+    snapshot_rows(automat, rows);
+    header.hash = snapshot_payload_hash(rows, header.words_per_row, header.height);
+    memcpy(map, &header, sizeof(header));
+    return munmap(map, bytes) == 0;
+}
+
+// restores type, size, rule, boundary, generation and cells, the engine stays.
+// the bit engines copy the rows straight from the mapping, restart() still goes back to
+// the state before the simulation started
+template<typename T> bool load_snapshot(Cell_Automat<T>& automat, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+	std::cout << "snapshot: could not open " << path << "\n";
+	return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < snapshot_header_bytes) {
+	std::cout << "snapshot: " << path << " is too short\n";
+	close(fd);
+	return false;
+    }
+    size_t bytes = info.st_size;
+    const u8* map = (const u8*)mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+	std::cout << "snapshot: could not map " << path << "\n";
+	return false;
+    }
+    Snapshot_Header header;
+    memcpy(&header, map, sizeof(header));
+    const u64* rows = (const u64*)(map + header.payload_offset);
+    bool valid = !memcmp(header.magic, snapshot_magic, sizeof(header.magic)) && header.version == snapshot_version
+	&& header.type < AUTOMATA_TYPE_MAX && header.boundary < BOUNDARY_MAX && header.width && header.height
+	&& header.words_per_row == WORDS_FOR(header.width) && header.payload_offset % snapshot_header_bytes == 0
+	&& header.payload_offset >= sizeof(header)
+	&& header.payload_bytes == sizeof(u64) * header.words_per_row * header.height
+	&& header.payload_offset + header.payload_bytes <= bytes;
+    if (!valid || snapshot_payload_hash(rows, header.words_per_row, header.height) != header.hash) {
+	std::cout << "snapshot: " << path << (valid ? " is corrupt, the hash does not match\n" : " is not a snapshot\n");
+	munmap((void*)map, bytes);
+	return false;
+    }
+
+    bool reinit = automat.type != (Automata_Type)header.type || automat.width != header.width || automat.height != header.height;
+    if (reinit) automat.init((Automata_Type)header.type, header.width, header.height, automat.zero, automat.one);
+    if (automat.boundary != (Boundary)header.boundary) automat.set_boundary((Boundary)header.boundary);
+    // the rule is set without set_ruleset(), the engine is loaded once below
+    if (automat.type == ONE_DIM) {
+	automat.one_dim_rules = header.one_dim_rules & 0xFF;
+	automat.streaming = header.streaming;
+    }
+    else {
+	automat.life_rule.set(header.birth, header.survive);
+	automat.init_grids();
+    }
+    automat.generation = header.generation;
+
+    restore_rows(automat, rows);
+    // the initial state of the old size is gone, restart() returns to the snapshot.
+    // restart() starts at generation 0, so a 1D ring is stored oldest row first
+    if (reinit) {
+	const T* cells = automat.sync_cells();
+	for (size_t r = 0; r < automat.height; ++r) {
+	    size_t row = (automat.first_row() + r) % automat.height;
+	    memcpy(automat.initial_cells + r * automat.width, cells + row * automat.width, sizeof(T) * automat.width);
+	}
+    }
+    munmap((void*)map, bytes);
+    return true;
+}
+
+// checkpoints without stopping the simulation: start() packs the rows on the calling thread,
+// one bit per cell, and a writer thread maps and fills the file while the automat keeps stepping
+class Checkpoint_Writer {
+public:
+    ~Checkpoint_Writer() {
+	wait();
+    }
+
+    // false if the last checkpoint is still being written
+    template<typename T> bool start(Cell_Automat<T>& automat, const char* path) {
+	if (busy) return false;
+	wait();
+	header = snapshot_header(automat);
+	rows.resize(header.words_per_row * header.height);
+	snapshot_rows(automat, rows.data());
+	std::string file = path;
+	busy = true;
+	thread = std::thread([this, file] {
+	    write_snapshot_file(file.c_str(), header, rows.data());
+	    busy = false;
+	});
+	return true;
+    }
+
+    bool writing() const {
+	return busy;
+    }
+
+    void wait() {
+	if (thread.joinable()) thread.join();
+    }
+
+private:
+    Snapshot_Header header;
+    std::vector<u64> rows;
+    std::thread thread;
+    std::atomic<bool> busy = false;
+};
@@ -0,0 +1,369 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "common.h"
+#include "bit_automat.h"
+#include "state_hash.h"
+
+// apgsearch style soup search: random soups run on the bit engine until they repeat, their
+// ash is split into objects and every object is counted in a census under a name that is the
+// same for every phase and orientation of it
+
+// objects and how often they came out of the soups, names are apgcodes like xs4_33 (block)
+// and xp2_7 (blinker)
+struct Census {
+    std::unordered_map<std::string, u64> counts;
+
+    void add(const std::string& name, u64 count = 1) {
+	counts[name] += count;
+    }
+
+    void merge(Census& other) {
+	for (auto& entry : other.counts) counts[entry.first] += entry.second;
+	other.counts.clear();
+    }
+
+    u64 total() const {
+	u64 sum = 0;
+	for (auto& entry : counts) sum += entry.second;
+	return sum;
+    }
+
+    // most common first, equal counts by name
+    std::vector<std::pair<std::string, u64>> sorted() const {
+	std::vector<std::pair<std::string, u64>> entries(counts.begin(), counts.end());
+	std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+	    return a.second != b.second ? a.second > b.second : a.first < b.first;
+	});
+	return entries;
+    }
+};
+
+// the seed of soup index of a search, splitmix64 of both, so every soup can be rerun on its own
+static u64 soup_seed(u64 search_seed, u64 index) {
+    u64 x = search_seed + 0x9e3779b97f4a7c15 * (index + 1);
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+}
+
+// a small bitmap of one object, row major
+struct Object_Cells {
+    size_t width = 0;
+    size_t height = 0;
+    std::vector<u8> cells;
+
+    bool get(size_t x, size_t y) const {
+	return cells[y * width + x];
+    }
+
+    bool operator==(const Object_Cells& other) const {
+	return width == other.width && height == other.height && cells == other.cells;
+    }
+};
+
+// extended wechsler format of apgcodes: strips of 5 rows, a character per column with the top
+// row in the lowest bit, runs of empty columns shortened to w, x and y?, strips joined by z
+static std::string wechsler(const Object_Cells& object) {
+    static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+    std::string code;
+    for (size_t strip = 0; strip * 5 < object.height; ++strip) {
+	if (strip) code += 'z';
+	std::vector<int> columns(object.width, 0);
+	for (size_t x = 0; x < object.width; ++x) {
+	    for (size_t r = 0; r < 5 && strip * 5 + r < object.height; ++r) columns[x] |= object.get(x, strip * 5 + r) << r;
+	}
+	// empty columns at the end of a strip are left out
+	while (!columns.empty() && columns.back() == 0) columns.pop_back();
+	size_t zeros = 0;
+	auto flush = [&] {
+	    while (zeros >= 4) {
+		size_t run = std::min<size_t>(zeros - 4, 35);
+		code += 'y';
+		code += digits[run];
+		zeros -= run + 4;
+	    }
+	    if (zeros == 3) code += 'x';
+	    else if (zeros == 2) code += 'w';
+	    else if (zeros == 1) code += '0';
+	    zeros = 0;
+	};
+	for (int column : columns) {
+	    if (column == 0) {
+		zeros++;
+		continue;
+	    }
+	    flush();
+	    code += digits[column];
+	}
+    }
+    return code;
+}
+
+// one of the 8 symmetries of the square, cropped to the live cells
+static Object_Cells transformed(const Object_Cells& object, int symmetry) {
+    bool swap = symmetry & 4;
+    size_t width = swap ? object.height : object.width;
+    size_t x0 = width, y0 = swap ? object.width : object.height, x1 = 0, y1 = 0;
+    std::vector<std::pair<size_t, size_t>> live;
+    for (size_t y = 0; y < object.height; ++y) {
+	for (size_t x = 0; x < object.width; ++x) {
+	    if (!object.get(x, y)) continue;
+	    size_t tx = symmetry & 1 ? object.width - 1 - x : x;
+	    size_t ty = symmetry & 2 ? object.height - 1 - y : y;
+	    if (swap) std::swap(tx, ty);
+	    live.push_back({tx, ty});
+	    x0 = std::min(x0, tx);
+	    y0 = std::min(y0, ty);
+	    x1 = std::max(x1, tx + 1);
+	    y1 = std::max(y1, ty + 1);
+	}
+    }
+    Object_Cells out;
+    if (live.empty()) return out;
+    out.width = x1 - x0;
+    out.height = y1 - y0;
+    out.cells.assign(out.width * out.height, 0);
+    for (auto& cell : live) out.cells[(cell.second - y0) * out.width + cell.first - x0] = 1;
+    return out;
+}
+
+// the shortest code over the phases and symmetries, the smallest of equally short ones
+static std::string apgcode(const std::vector<Object_Cells>& phases, size_t period) {
+    std::string best;
+    size_t population = 0;
+    for (const Object_Cells& phase : phases) {
+	for (int symmetry = 0; symmetry < 8; ++symmetry) {
+	    std::string code = wechsler(transformed(phase, symmetry));
+	    if (best.empty() || code.size() < best.size() || (code.size() == best.size() && code < best)) best = code;
+	}
+    }
+    for (u8 cell : phases[0].cells) population += cell;
+    if (period == 1) return "xs" + std::to_string(population) + "_" + best;
+    return "xp" + std::to_string(period) + "_" + best;
+}
+
+struct Soup_Search_Options {
+    // the soup is soup_size x soup_size random cells in the middle of the universe
+    size_t soup_size = 16;
+    // empty cells around the soup, the universe is a torus whose border band is emptied
+    // every generation, so escaping gliders vanish instead of coming back
+    size_t margin = 64;
+    size_t max_generations = 20000;
+    size_t max_period = 1024;
+};
+
+// runs soups one after the other on its own universe, one per thread
+class Soup_Runner {
+public:
+    // band along the edges that is emptied every generation
+    static constexpr size_t kill_band = 2;
+    // objects this close to the edges are wreckage of escaping gliders and not counted
+    static constexpr size_t ignore_band = 12;
+
+    Soup_Search_Options options;
+    Bit_Automat life;
+    u64 generations = 0;
+
+    void init(const Soup_Search_Options& new_options, const Life_Rule& rule) {
+	options = new_options;
+	// whole words, so there is no halo bit in the last word
+	size_t size = (options.soup_size + 2 * options.margin + WORD_BITS - 1) / WORD_BITS * WORD_BITS;
+	life.init(size, size);
+	life.boundary = BOUNDARY_TORUS;
+	life.set_rule(rule);
+    }
+
+    // false if the soup did not settle within max_generations, it is then counted as unstable
+    bool run(u64 seed, Census& census) {
+	life.clear();
+	size_t x0 = (life.width - options.soup_size) / 2;
+	size_t y0 = (life.height - options.soup_size) / 2;
+	u64 bits = 0;
+	for (size_t i = 0; i < options.soup_size * options.soup_size; ++i) {
+	    if (i % 64 == 0) bits = soup_seed(seed, i / 64);
+	    life.set(x0 + i % options.soup_size, y0 + i / options.soup_size, BIT_AT(i % 64, bits));
+	}
+	Cycle_Detector cycles;
+	cycles.max_period = options.max_period;
+	size_t generation = 0;
+	while (!cycles.observe(hash(), generation)) {
+	    if (generation == options.max_generations) {
+		census.add("unstable");
+		return false;
+	    }
+	    step();
+	    generation++;
+	}
+	generations += generation;
+	split(cycles.period, census);
+	return true;
+    }
+
+private:
+    // the phases of the cycle, packed rows without the padding
+    std::vector<std::vector<u64>> phases;
+    // object index of every live cell of the union of the phases, -1 for none
+    std::vector<int> labels;
+    std::vector<size_t> stack;
+
+    void step() {
+	life.step();
+	for (size_t y = 0; y < life.height; ++y) {
+	    u64* row = life.cells.row(y);
+	    bool edge_row = y < kill_band || y >= life.height - kill_band;
+	    u64 changed = 0;
+	    if (edge_row) {
+		for (size_t i = 0; i < life.words; ++i) {
+		    changed |= row[i];
+		    row[i] = 0;
+		}
+	    }
+	    else {
+		u64 left = (u64(1) << kill_band) - 1;
+		u64 right = ~(~u64(0) >> kill_band);
+		changed = (row[0] & left) | (row[life.words - 1] & right);
+		row[0] &= ~left;
+		row[life.words - 1] &= ~right;
+	    }
+	    // the universe is a few tiles, marking them all is cheaper than finding the right ones
+	    if (changed) life.mark_all_changed();
+	}
+    }
+
+    u64 hash() const {
+	u64 value = 0;
+	for (size_t y = 0; y < life.height; ++y) value ^= mix_row(hash_row(life.cells.row(y), sizeof(u64) * life.words), y);
+	return value;
+    }
+
+    bool alive(const std::vector<u64>& phase, size_t x, size_t y) const {
+	return BIT_AT(x % WORD_BITS, phase[y * life.words + x / WORD_BITS]);
+    }
+
+    // the current generation is the first of a cycle of period generations
+    void split(u64 period, Census& census) {
+	size_t width = life.width;
+	size_t height = life.height;
+	phases.resize(period);
+	for (u64 p = 0; p < period; ++p) {
+	    phases[p].resize(life.words * height);
+	    for (size_t y = 0; y < height; ++y) memcpy(&phases[p][y * life.words], life.cells.row(y), sizeof(u64) * life.words);
+	    if (p + 1 < period) step();
+	}
+	// 8 connected parts of the cells that are alive in any phase
+	labels.assign(width * height, -1);
+	std::vector<u64> live(life.words * height, 0);
+	for (const std::vector<u64>& phase : phases) {
+	    for (size_t i = 0; i < live.size(); ++i) live[i] |= phase[i];
+	}
+	int count = 0;
+	for (size_t y = 0; y < height; ++y) {
+	    for (size_t x = 0; x < width; ++x) {
+		if (!alive(live, x, y) || labels[y * width + x] >= 0) continue;
+		size_t bx0 = x, by0 = y, bx1 = x, by1 = y;
+		labels[y * width + x] = count;
+		stack.assign(1, y * width + x);
+		while (!stack.empty()) {
+		    size_t cell = stack.back();
+		    stack.pop_back();
+		    size_t cx = cell % width;
+		    size_t cy = cell / width;
+		    bx0 = std::min(bx0, cx);
+		    bx1 = std::max(bx1, cx);
+		    by0 = std::min(by0, cy);
+		    by1 = std::max(by1, cy);
+		    for (size_t ny = cy ? cy - 1 : 0; ny <= std::min(cy + 1, height - 1); ++ny) {
+			for (size_t nx = cx ? cx - 1 : 0; nx <= std::min(cx + 1, width - 1); ++nx) {
+			    if (!alive(live, nx, ny) || labels[ny * width + nx] >= 0) continue;
+			    labels[ny * width + nx] = count;
+			    stack.push_back(ny * width + nx);
+			}
+		    }
+		}
+		if (bx0 >= ignore_band && by0 >= ignore_band && bx1 < width - ignore_band && by1 < height - ignore_band) {
+		    census.add(name(count, bx0, by0, bx1 + 1, by1 + 1, period));
+		}
+		count++;
+	    }
+	}
+    }
+
+    // the apgcode of the object with the label, inside the box [x0, x1) x [y0, y1)
+    std::string name(int label, size_t x0, size_t y0, size_t x1, size_t y1, u64 period) {
+	std::vector<Object_Cells> object(period);
+	for (u64 p = 0; p < period; ++p) {
+	    object[p].width = x1 - x0;
+	    object[p].height = y1 - y0;
+	    object[p].cells.assign(object[p].width * object[p].height, 0);
+	    for (size_t y = y0; y < y1; ++y) {
+		for (size_t x = x0; x < x1; ++x) {
+		    if (labels[y * life.width + x] == label && alive(phases[p], x, y)) object[p].cells[(y - y0) * object[p].width + x - x0] = 1;
+		}
+	    }
+	}
+	// the period of the whole ash is a multiple of the period of the object
+	u64 own = period;
+	for (u64 d = 1; d < period; ++d) {
+	    if (period % d == 0 && object[d] == object[0]) {
+		own = d;
+		break;
+	    }
+	}
+	object.resize(own);
+	return apgcode(object, own);
+    }
+};
+
+// runs soups [0, soups) of a seed on threads, every thread counts into its own census and
+// merges it into the shared one every merge_every soups
+class Soup_Search {
+public:
+    Soup_Search_Options options;
+    Life_Rule rule;
+    u64 seed = 0;
+    size_t merge_every = 256;
+    Census census;
+    std::atomic<u64> soups_done = 0;
+    std::atomic<u64> generations = 0;
+
+    void run(u64 soups, size_t threads) {
+	std::atomic<u64> next = 0;
+	std::vector<std::thread> workers;
+	for (size_t t = 0; t < threads; ++t) {
+	    workers.emplace_back([this, &next, soups] {
+		Soup_Runner runner;
+		runner.init(options, rule);
+		Census local;
+		size_t since_merge = 0;
+		for (u64 i = next++; i < soups; i = next++) {
+		    runner.run(soup_seed(seed, i), local);
+		    if (++since_merge == merge_every) {
+			merge(local, since_merge);
+			since_merge = 0;
+		    }
+		}
+		merge(local, since_merge);
+		generations += runner.generations;
+	    });
+	}
+	for (std::thread& worker : workers) worker.join();
+    }
+
+private:
+    std::mutex mutex;
+
+    void merge(Census& local, size_t soups) {
+	std::lock_guard<std::mutex> lock(mutex);
+	census.merge(local);
+	soups_done += soups;
+    }
+};
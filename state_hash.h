@@ -0,0 +1,119 @@
+#pragma once
+#include <cassert>
+#include <cstring>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+#include "common.h"
+#include "grid.h"
+
+// 64 bit hash of a row of states, 8 bytes at a time
+static u64 hash_row(const void* data, size_t bytes) {
+    const u8* p = (const u8*)data;
+    u64 hash = 0x9e3779b97f4a7c15 ^ bytes;
+    size_t i = 0;
+    for (; i + 8 <= bytes; i += 8) {
+	u64 word;
+	memcpy(&word, p + i, 8);
+	hash = (hash ^ word) * 0xff51afd7ed558ccd;
+	hash ^= hash >> 32;
+    }
+    u64 tail = 0;
+    if (i < bytes) memcpy(&tail, p + i, bytes - i);
+    hash = (hash ^ tail) * 0xc4ceb9fe1a85ec53;
+    return hash ^ (hash >> 29);
+}
+
+// the row hash mixed with its index, so equal rows at different places do not cancel out
+static u64 mix_row(u64 row_hash, size_t y) {
+    u64 x = row_hash + 0x9e3779b97f4a7c15 * (y + 1);
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+}
+
+// hash of a width x height grid of states, the xor of the mixed hashes of its rows.
+// rows are stored as they are, a 1D ring in generation order is the same for every engine.
+// update() only rehashes the dirty rows, so hashing every generation costs as much as
+// the rows that changed
+template<typename T> class State_Hash {
+public:
+    size_t width = 0;
+    size_t height = 0;
+    u64 value = 0;
+
+    void init(size_t width, size_t height) {
+	this->width = width;
+	this->height = height;
+	rows.assign(height, 0);
+	value = 0;
+	initialized = false;
+    }
+
+    // the first update after init() hashes every row
+    u64 update(const T* cells, const Dirty_Rows& dirty) {
+	assert(dirty.height() == height);
+	for (size_t y = 0; y < height; ++y) {
+	    if (initialized && !dirty.is_dirty(y)) continue;
+	    u64 row = mix_row(hash_row(cells + y * width, sizeof(T) * width), y);
+	    value ^= rows[y] ^ row;
+	    rows[y] = row;
+	}
+	initialized = true;
+	return value;
+    }
+
+    static u64 hash(const T* cells, size_t width, size_t height) {
+	u64 value = 0;
+	for (size_t y = 0; y < height; ++y) value ^= mix_row(hash_row(cells + y * width, sizeof(T) * width), y);
+	return value;
+    }
+
+private:
+    bool initialized = false;
+    // mixed hash of every row, its part of value
+    std::vector<u64> rows;
+};
+
+// finds the generation where a run enters a cycle from the hash of every generation.
+// the hashes of the last max_period generations are kept, the first hash that comes back
+// was the first generation of the cycle, as long as no generation was left out
+class Cycle_Detector {
+public:
+    // longest period that is found, and the memory of the detector
+    size_t max_period = 1024;
+    // 0 until a cycle was found, 1 for a still life
+    u64 period = 0;
+    u64 start = 0;
+
+    void clear() {
+	seen.clear();
+	order.clear();
+	period = 0;
+	start = 0;
+    }
+
+    // true once the hash of generation was the hash of one of the last max_period generations
+    bool observe(u64 hash, u64 generation) {
+	if (period) return true;
+	auto found = seen.find(hash);
+	if (found != seen.end()) {
+	    period = generation - found->second;
+	    start = found->second;
+	    return true;
+	}
+	seen[hash] = generation;
+	order.push_back({hash, generation});
+	if (order.size() > max_period) {
+	    auto oldest = seen.find(order.front().first);
+	    if (oldest != seen.end() && oldest->second == order.front().second) seen.erase(oldest);
+	    order.pop_front();
+	}
+	return false;
+    }
+
+private:
+    std::unordered_map<u64, u64> seen;
+    // hash and generation in the order they were seen
+    std::deque<std::pair<u64, u64>> order;
+};
@@ -0,0 +1,132 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <cassert>
+#include "common.h"
+
+// persistent workers for banded stepping. the calling thread works on bands too,
+// so a pool of one thread runs everything inline
+class Thread_Pool {
+public:
+    Thread_Pool(size_t threads = std::thread::hardware_concurrency()) {
+	set_threads(threads);
+    }
+
+    ~Thread_Pool() {
+	stop_workers();
+    }
+
+    // more bands than threads so uneven bands (sparse tiles) still balance out
+    static constexpr size_t bands_per_thread = 4;
+
+    size_t threads() const {
+	return workers.size() + 1;
+    }
+
+    void set_threads(size_t threads) {
+	if (threads == 0) threads = 1;
+	if (threads == this->threads() && !workers.empty()) return;
+	stop_workers();
+	stopping = false;
+	for (size_t i = 1; i < threads; ++i) {
+	    workers.emplace_back([this] { work(); });
+	}
+    }
+
+    // calls func(begin, end) for bands covering [0, count), returns when all of them are done
+    void parallel_for(size_t count, const std::function<void(size_t, size_t)>& func) {
+	if (count == 0) return;
+	size_t bands = threads() * bands_per_thread;
+	if (bands > count) bands = count;
+	if (bands == 1) {
+	    func(0, count);
+	    return;
+	}
+	{
+	    std::lock_guard<std::mutex> lock(mutex);
+	    job = &func;
+	    job_count = count;
+	    job_bands = bands;
+	    bands_left = bands;
+	    job_id++;
+	    next_band = (job_id & 0xFFFFFFFF) << 32;
+	}
+	wake.notify_all();
+	run_bands(&func, count, bands, job_id);
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [this] { return bands_left == 0; });
+	job = NULL;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(size_t, size_t)>* job = NULL;
+    size_t job_count = 0;
+    size_t job_bands = 0;
+    size_t job_id = 0;
+    // id of the job in the upper half and its next band in the lower one, so a worker that
+    // wakes up late can not take a band of the job after its own
+    std::atomic<u64> next_band = 0;
+    size_t bands_left = 0;
+    bool stopping = false;
+
+    // the job is passed in as it was when the worker woke up, the shared fields may already
+    // belong to the next one
+    void run_bands(const std::function<void(size_t, size_t)>* func, size_t count, size_t bands, size_t id) {
+	size_t finished = 0;
+	u64 tag = (u64)(id & 0xFFFFFFFF) << 32;
+	u64 claim = next_band.load();
+	while (true) {
+	    if ((claim & ~u64(0xFFFFFFFF)) != tag || (claim & 0xFFFFFFFF) >= bands) break;
+	    if (!next_band.compare_exchange_weak(claim, claim + 1)) continue;
+	    size_t band = claim & 0xFFFFFFFF;
+	    size_t begin = count * band / bands;
+	    size_t end = count * (band + 1) / bands;
+	    (*func)(begin, end);
+	    finished++;
+	    claim = next_band.load();
+	}
+	if (finished) {
+	    std::lock_guard<std::mutex> lock(mutex);
+	    bands_left -= finished;
+	    if (bands_left == 0) done.notify_all();
+	}
+    }
+
+    void work() {
+	size_t seen = 0;
+	while (true) {
+	    const std::function<void(size_t, size_t)>* func;
+	    size_t count;
+	    size_t bands;
+	    {
+		std::unique_lock<std::mutex> lock(mutex);
+		wake.wait(lock, [&] { return stopping || job_id != seen; });
+		if (stopping) return;
+		seen = job_id;
+		func = job;
+		count = job_count;
+		bands = job_bands;
+	    }
+	    // the job may have finished and been replaced before the lock was taken
+	    if (func) run_bands(func, count, bands, seen);
+	}
+    }
+
+    void stop_workers() {
+	{
+	    std::lock_guard<std::mutex> lock(mutex);
+	    stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers) worker.join();
+	workers.clear();
+    }
+};